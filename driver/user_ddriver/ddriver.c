@@ -1,7 +1,9 @@
+#define _GNU_SOURCE                                  /* O_DIRECT */
 #include "stdio.h"
 #include "stdlib.h"
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include "string.h"
 #include <linux/fs.h>
@@ -10,6 +12,11 @@
 #include "errno.h"
 #include <pwd.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
 extern int errno;
 
@@ -46,34 +53,73 @@ extern int errno;
 
 #define CONFIG_DISK_SZ  (4 * 1024 * 1024)
 #define CONFIG_BLOCK_SZ (512)
+#define CONFIG_TRACKS   (100)
+
+#define ENV_PROFILE     "DDRIVER_PROFILE"            /* hdd（默认）、ssd或nodelay */
+#define ENV_DISK_SZ     "DDRIVER_DISK_SZ"            /* 以下各项覆盖所选配置中的对应值 */
+#define ENV_IO_SZ       "DDRIVER_IO_SZ"
+#define ENV_TRACKS      "DDRIVER_TRACKS"
+#define ENV_READ_LAT    "DDRIVER_READ_LAT_US"
+#define ENV_WRITE_LAT   "DDRIVER_WRITE_LAT_US"
+#define ENV_SEEK_LAT    "DDRIVER_SEEK_LAT_US"
+
+#define URING_DEPTH     32                           /* 提交队列深度，也是注册缓冲区的个数 */
+#define URING_BUF_SZ    (64 * 1024)                  /* 每个注册缓冲区的大小，更大的请求分片 */
+#define URING_ALIGN     4096                         /* O_DIRECT要求的缓冲区对齐 */
 /******************************************************************************
 * SECTION: Macro Functions 
 *******************************************************************************/
 #define IGNORE_ARG(arg)         ((void)arg)
-#define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
-#define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
+#define IS_ADDR_ALIGN(addr)     (addr % disk.iounit_size == 0)
+#define ADDR_ROUND_UP(addr)     ((addr / disk.iounit_size) * disk.iounit_size)
 
 #define INC_READCNT(disk)       (disk.read_cnt++)
 #define INC_WRITECNT(disk)      (disk.write_cnt++)
 #define INC_SEEKCNT(disk)       (disk.seek_cnt++)
 
-#define RW_DELAY(disk, rw_ops)  (usleep(disk.rw_ops##_lat * 1000))
+#define RW_DELAY(disk, rw_ops)  do { if (disk.rw_ops##_lat > 0) usleep(disk.rw_ops##_lat); } while (0)
+#define IS_MAPPED(disk)         (disk.map_base != NULL)
+#define IS_URING(disk)          (disk.ring != NULL)
 /******************************************************************************
 * SECTION: Type definitions
 *******************************************************************************/
+/* 以原始系统调用使用的io_uring，字段与liburing的io_uring_sq/io_uring_cq对应 */
+struct uring
+{
+    int  ring_fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void   *sq_ring;
+    void   *cq_ring;                                 /* 内核支持单次映射时与sq_ring相同 */
+    size_t sq_ring_sz;
+    size_t cq_ring_sz;
+    size_t sqes_sz;
+    char   *bufs;                                    /* URING_DEPTH个注册缓冲区，按URING_ALIGN对齐 */
+};
+
 struct ddriver
 {
     int  ddriver_fd;                                 /* Disk ddriver_fd */
     int  read_cnt;
     int  write_cnt;
     int  seek_cnt;
-    int  read_lat;
+    int  read_lat;                                   /* 以下延迟的单位都是us */
     int  write_lat;
-    int  seek_lat;
+    int  seek_lat;                                   /* 旋转一整圈 */
     int  track_num;
     int  major_num;
-    int  layout_size;
+    int64_t layout_size;                             /* 设备字节数，可超过2GB */
     int  iounit_size;
+    char *map_base;                                  /* DDRIVER_OPEN_MMAP时设备镜像的映射，否则为NULL */
+    off_t map_pos;                                   /* 映射方式下的磁头位置 */
+    struct uring *ring;                              /* DDRIVER_OPEN_URING时的io_uring引擎，否则为NULL */
 };
 /******************************************************************************
 * SECTION: Global Variable
@@ -83,48 +129,590 @@ struct ddriver disk = {
     .read_cnt    = 0,
     .write_cnt   = 0,
     .seek_cnt    = 0,
-    .read_lat    = 2,       /* 2ms */       
-    .write_lat   = 1,       /* 1ms */
-    .seek_lat    = 4,       /* 4.17ms per 360 degree */
+    .read_lat    = 2000,    /* 2ms */       
+    .write_lat   = 1000,    /* 1ms */
+    .seek_lat    = 4000,    /* 4.17ms per 360 degree */
     .major_num   = 0,
-    .track_num   = 100,
+    .track_num   = CONFIG_TRACKS,
     .layout_size = CONFIG_DISK_SZ,
-    .iounit_size = CONFIG_BLOCK_SZ
+    .iounit_size = CONFIG_BLOCK_SZ,
+    .map_base    = NULL,
+    .map_pos     = 0,
+    .ring        = NULL
+};
+
+/* 可选的延迟配置，设备大小与IO单元沿用默认值 */
+static const struct ddriver_config profiles[] = {
+    [DDRIVER_PROFILE_HDD]     = { CONFIG_DISK_SZ, CONFIG_BLOCK_SZ, CONFIG_TRACKS, 2000, 1000, 4000 },
+    [DDRIVER_PROFILE_SSD]     = { CONFIG_DISK_SZ, CONFIG_BLOCK_SZ, CONFIG_TRACKS, 100,  200,  0    },
+    [DDRIVER_PROFILE_NODELAY] = { CONFIG_DISK_SZ, CONFIG_BLOCK_SZ, CONFIG_TRACKS, 0,    0,    0    },
 };
 
 FILE *debugf = NULL;
+
+#define AIO_IOV_MAX 64                               /* 一次preadv/pwritev的最大段数 */
+
+/* 同步接口与异步后台线程互斥地使用设备，一次只有一个传输 */
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* 异步队列：aio_pending为尚未取走的请求，后台线程每次取走全部并完成后唤醒等待者 */
+static pthread_mutex_t     aio_lock        = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t      aio_submit_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t      aio_done_cond   = PTHREAD_COND_INITIALIZER;
+static struct ddriver_req *aio_pending     = NULL;
+static pthread_t           aio_worker;
+static int                 aio_running     = 0;
+static int                 aio_stop        = 0;
+static off_t               aio_head        = 0;       /* 后台线程的磁头位置，用于排序 */
+static unsigned long       aio_seq         = 0;       /* 下一个请求的提交序号 */
 /******************************************************************************
 * SECTION: Helper Functions
 *******************************************************************************/
 int check_valid(size_t size) {
-    if (size != CONFIG_BLOCK_SZ){
-        user_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
+    if (size != (size_t)disk.iounit_size){
+        user_alert("io size %ld should align to %d", size, disk.iounit_size);
+        return -EIO;
+    }
+    return 0;
+}
+
+int check_valid_batch(size_t size) {
+    if (size == 0 || size % disk.iounit_size != 0){
+        user_alert("batch io size %ld should be a multiple of %d", size, disk.iounit_size);
         return -EIO;
     }
     return 0;
 }
 
 int emulate_rotate(int fd, off_t start, off_t end) {
-    int bytes_per_track = disk.layout_size / disk.track_num;
+    int64_t bytes_per_track = disk.layout_size / disk.track_num;
     int lat_per_track = disk.seek_lat;
-    int distance = abs(end - start) % bytes_per_track; 
+    int64_t distance = (end > start ? end - start : start - end) % bytes_per_track; 
     
-    if (distance == 0) {
+    if (distance == 0 || lat_per_track == 0) {
         return 0;
     }
 
-    usleep(distance * lat_per_track / bytes_per_track * 1000);
+    usleep((long long)distance * lat_per_track / bytes_per_track);
+    return 0;
+}
+
+void get_config(struct ddriver_config *config) {
+    config->disk_size   = disk.layout_size;
+    config->iounit_size = disk.iounit_size;
+    config->track_num   = disk.track_num;
+    config->read_lat    = disk.read_lat;
+    config->write_lat   = disk.write_lat;
+    config->seek_lat    = disk.seek_lat;
+}
+
+/* 应用一组配置，设备大小变化时扩展镜像文件并重新映射 */
+int set_config(int fd, const struct ddriver_config *config) {
+    char *base;
+
+    if (config->iounit_size < CONFIG_BLOCK_SZ || config->iounit_size % CONFIG_BLOCK_SZ != 0 ||
+        config->disk_size <= 0 || config->disk_size % config->iounit_size != 0 ||
+        config->track_num <= 0 || config->read_lat < 0 || config->write_lat < 0 || config->seek_lat < 0) {
+        user_panic("invalid config: size %lld, io %d, tracks %d",
+                   (long long)config->disk_size, config->iounit_size, config->track_num);
+        return -EINVAL;
+    }
+    if (fd >= 0 && config->disk_size != disk.layout_size) {
+        if (posix_fallocate(fd, 0, config->disk_size) != 0) {
+            user_panic("low space");
+            return -ENOSPC;
+        }
+        if (IS_MAPPED(disk)) {
+            base = mmap(NULL, config->disk_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (base == MAP_FAILED) {
+                user_panic("can't map device: %s", strerror(errno));
+                return -ENOMEM;
+            }
+            munmap(disk.map_base, disk.layout_size);
+            disk.map_base = base;
+        }
+    }
+    disk.layout_size = config->disk_size;
+    disk.iounit_size = config->iounit_size;
+    disk.track_num   = config->track_num;
+    disk.read_lat    = config->read_lat;
+    disk.write_lat   = config->write_lat;
+    disk.seek_lat    = config->seek_lat;
+    return 0;
+}
+
+int env_int(const char *name, int def) {
+    char *val = getenv(name);
+    return val != NULL && *val != '\0' ? atoi(val) : def;
+}
+
+int64_t env_int64(const char *name, int64_t def) {
+    char *val = getenv(name);
+    return val != NULL && *val != '\0' ? strtoll(val, NULL, 0) : def;
+}
+
+/* 由环境变量确定打开时的配置：先选DDRIVER_PROFILE，再逐项覆盖 */
+int load_env_config() {
+    struct ddriver_config config;
+    char *name = getenv(ENV_PROFILE);
+
+    get_config(&config);
+    if (name != NULL && strcmp(name, "hdd") == 0) {
+        config = profiles[DDRIVER_PROFILE_HDD];
+    }
+    else if (name != NULL && strcmp(name, "ssd") == 0) {
+        config = profiles[DDRIVER_PROFILE_SSD];
+    }
+    else if (name != NULL && strcmp(name, "nodelay") == 0) {
+        config = profiles[DDRIVER_PROFILE_NODELAY];
+    }
+    else if (name != NULL && *name != '\0') {
+        user_panic("unknown profile [%s], using hdd", name);
+    }
+    config.disk_size   = env_int64(ENV_DISK_SZ, config.disk_size);
+    config.iounit_size = env_int(ENV_IO_SZ, config.iounit_size);
+    config.track_num   = env_int(ENV_TRACKS, config.track_num);
+    config.read_lat    = env_int(ENV_READ_LAT, config.read_lat);
+    config.write_lat   = env_int(ENV_WRITE_LAT, config.write_lat);
+    config.seek_lat    = env_int(ENV_SEEK_LAT, config.seek_lat);
+    return set_config(-1, &config);
+}
+
+/* 映射方式下在磁头位置拷贝size字节并移动磁头，越过设备末尾时报错 */
+int map_xfer(char *buf, size_t size, int is_write) {
+    if (disk.map_pos < 0 || disk.map_pos + (off_t)size > disk.layout_size) {
+        user_alert("io at %ld size %ld beyond device", disk.map_pos, size);
+        return -EIO;
+    }
+    if (is_write) {
+        memcpy(disk.map_base + disk.map_pos, buf, size);
+    }
+    else {
+        memcpy(buf, disk.map_base + disk.map_pos, size);
+    }
+    disk.map_pos += size;
     return 0;
 }
 /******************************************************************************
+* SECTION: io_uring Engine
+* 以DDRIVER_OPEN_URING打开时，设备读写经由io_uring完成。镜像文件注册为固定文件，
+* URING_DEPTH个对齐的缓冲区注册为固定缓冲区，用READ_FIXED/WRITE_FIXED免去每次
+* 请求时内核对用户页的映射。一组请求切成不超过URING_BUF_SZ的片，每轮最多URING_DEPTH片
+* 一次提交、同时在途，数据在注册缓冲区与调用者的缓冲之间拷贝，因此也满足O_DIRECT的
+* 对齐要求。调用者持有io_lock，引擎本身不加锁。
+*******************************************************************************/
+static int sys_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+void uring_exit(struct uring *r) {
+    if (r->sqes != NULL && r->sqes != MAP_FAILED) {
+        munmap(r->sqes, r->sqes_sz);
+    }
+    if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring) {
+        munmap(r->cq_ring, r->cq_ring_sz);
+    }
+    if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED) {
+        munmap(r->sq_ring, r->sq_ring_sz);
+    }
+    if (r->ring_fd >= 0) {
+        close(r->ring_fd);
+    }
+    free(r->bufs);
+    free(r);
+}
+
+/**
+ * @brief 建立io_uring，注册镜像文件与缓冲区
+ * 
+ * @param fd 镜像文件
+ * @return struct uring* 内核不支持或权限不足时返回NULL
+ */
+struct uring *uring_init(int fd) {
+    struct io_uring_params p;
+    struct iovec iov[URING_DEPTH];
+    struct uring *r = calloc(1, sizeof(struct uring));
+    int i;
+
+    memset(&p, 0, sizeof(p));
+    r->ring_fd = sys_uring_setup(URING_DEPTH, &p);
+    if (r->ring_fd < 0) {
+        goto fail;
+    }
+    r->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_sz > r->sq_ring_sz) {
+            r->sq_ring_sz = r->cq_ring_sz;
+        }
+        r->cq_ring_sz = r->sq_ring_sz;
+    }
+    r->sq_ring = mmap(NULL, r->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      r->ring_fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+        goto fail;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    }
+    else {
+        r->cq_ring = mmap(NULL, r->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          r->ring_fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED) {
+            goto fail;
+        }
+    }
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->ring_fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        goto fail;
+    }
+    r->sq_head  = (unsigned *)((char *)r->sq_ring + p.sq_off.head);
+    r->sq_tail  = (unsigned *)((char *)r->sq_ring + p.sq_off.tail);
+    r->sq_mask  = (unsigned *)((char *)r->sq_ring + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ring + p.sq_off.array);
+    r->cq_head  = (unsigned *)((char *)r->cq_ring + p.cq_off.head);
+    r->cq_tail  = (unsigned *)((char *)r->cq_ring + p.cq_off.tail);
+    r->cq_mask  = (unsigned *)((char *)r->cq_ring + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)((char *)r->cq_ring + p.cq_off.cqes);
+
+    if (posix_memalign((void **)&r->bufs, URING_ALIGN, URING_DEPTH * URING_BUF_SZ) != 0) {
+        r->bufs = NULL;
+        goto fail;
+    }
+    for (i = 0; i < URING_DEPTH; i++) {
+        iov[i].iov_base = r->bufs + i * URING_BUF_SZ;
+        iov[i].iov_len  = URING_BUF_SZ;
+    }
+    if (sys_uring_register(r->ring_fd, IORING_REGISTER_BUFFERS, iov, URING_DEPTH) < 0 ||
+        sys_uring_register(r->ring_fd, IORING_REGISTER_FILES, &fd, 1) < 0) {
+        goto fail;
+    }
+    return r;
+fail:
+    user_panic("can't set up io_uring: %s", strerror(errno));
+    uring_exit(r);
+    return NULL;
+}
+
+/**
+ * @brief 用io_uring完成一组请求，结果写入各请求的result
+ * 
+ * @param reqs 
+ * @param n 
+ * @return int 0全部成功，否则为第一个失败请求的错误码
+ */
+int uring_rw(struct ddriver_req **reqs, int n) {
+    struct uring *r = disk.ring;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    int    slot_req[URING_DEPTH];
+    size_t slot_pos[URING_DEPTH];
+    size_t slot_len[URING_DEPTH];
+    size_t done = 0;
+    unsigned tail, head;
+    int i = 0, k, slots, s, ret = 0;
+
+    for (k = 0; k < n; k++) {
+        reqs[k]->result = (int)reqs[k]->size;
+    }
+    while (i < n) {
+        tail = *r->sq_tail;
+        for (slots = 0; slots < URING_DEPTH && i < n; slots++) {
+            slot_req[slots] = i;
+            slot_pos[slots] = done;
+            slot_len[slots] = reqs[i]->size - done < URING_BUF_SZ ? reqs[i]->size - done : URING_BUF_SZ;
+            if (reqs[i]->is_write) {
+                memcpy(r->bufs + slots * URING_BUF_SZ, reqs[i]->buf + done, slot_len[slots]);
+            }
+            sqe = &r->sqes[tail & *r->sq_mask];
+            memset(sqe, 0, sizeof(struct io_uring_sqe));
+            sqe->opcode    = reqs[i]->is_write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe->flags     = IOSQE_FIXED_FILE;
+            sqe->fd        = 0;                      /* 注册文件表中的下标 */
+            sqe->off       = reqs[i]->offset + done;
+            sqe->addr      = (unsigned long)(r->bufs + slots * URING_BUF_SZ);
+            sqe->len       = slot_len[slots];
+            sqe->buf_index = slots;
+            sqe->user_data = slots;
+            r->sq_array[tail & *r->sq_mask] = tail & *r->sq_mask;
+            tail++;
+            done += slot_len[slots];
+            if (done == reqs[i]->size) {
+                i++;
+                done = 0;
+            }
+        }
+        __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+        k = 0;
+        while (k < slots) {
+            if (sys_uring_enter(r->ring_fd, k == 0 ? slots : 0, slots - k, IORING_ENTER_GETEVENTS) < 0 &&
+                errno != EINTR) {
+                user_panic("io_uring enter error: %s", strerror(errno));
+                return -EIO;
+            }
+            head = *r->cq_head;
+            while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+                cqe = &r->cqes[head & *r->cq_mask];
+                s   = (int)cqe->user_data;
+                if (cqe->res != (int)slot_len[s]) {
+                    reqs[slot_req[s]]->result = cqe->res < 0 ? cqe->res : -EIO;
+                }
+                else if (!reqs[slot_req[s]]->is_write) {
+                    memcpy(reqs[slot_req[s]]->buf + slot_pos[s], r->bufs + s * URING_BUF_SZ, slot_len[s]);
+                }
+                head++;
+                k++;
+            }
+            __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+        }
+    }
+    for (k = 0; k < n; k++) {
+        if (ret == 0 && reqs[k]->result < 0) {
+            ret = reqs[k]->result;
+        }
+    }
+    return ret;
+}
+
+/* 同步接口在io_uring方式下的传输：从文件当前位置读写，完成后前移 */
+int uring_pos_xfer(int fd, char *buf, size_t size, int is_write) {
+    struct ddriver_req req, *preq = &req;
+    int ret;
+
+    req.offset   = lseek(fd, 0, SEEK_CUR);
+    req.buf      = buf;
+    req.size     = size;
+    req.is_write = is_write;
+    ret = uring_rw(&preq, 1);
+    lseek(fd, req.offset + size, SEEK_SET);
+    return ret;
+}
+/* 以IO单元大小试读一次，文件系统的对齐要求大于IO单元时O_DIRECT不可用 */
+int direct_probe() {
+    struct ddriver_req req, *preq = &req;
+
+    req.offset   = disk.iounit_size;
+    req.buf      = malloc(disk.iounit_size);
+    req.size     = disk.iounit_size;
+    req.is_write = 0;
+    if (uring_rw(&preq, 1) < 0) {
+        user_panic("O_DIRECT unavailable for io unit %d, using page cache", disk.iounit_size);
+        free(req.buf);
+        return -1;
+    }
+    free(req.buf);
+    return 0;
+}
+/******************************************************************************
+* SECTION: Async IO
+* 提交的请求进入队列，后台线程每次取走队列中的全部请求，按电梯算法（C-SCAN）从当前
+* 磁头位置向高地址依次服务，到末尾后回到最低地址；偏移相接且读写方向相同的请求合并
+* 为一次传输，只计一次寻道、旋转与传输延迟。io_uring方式下整批请求一次提交。
+* 范围重叠的请求必须按提交顺序完成：取走的请求先按提交序号排列，遇到与前面的请求
+* 重叠的请求就把批次切开，每一段内部互不重叠，才按电梯算法排序与合并。
+*******************************************************************************/
+static int aio_seq_cmp(const void *a, const void *b) {
+    const struct ddriver_req *x = *(struct ddriver_req * const *)a;
+    const struct ddriver_req *y = *(struct ddriver_req * const *)b;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static int aio_cmp(const void *a, const void *b) {
+    const struct ddriver_req *x = *(struct ddriver_req * const *)a;
+    const struct ddriver_req *y = *(struct ddriver_req * const *)b;
+    int x_wrap = x->offset < aio_head;               /* 磁头之前的请求排在下一轮 */
+    int y_wrap = y->offset < aio_head;
+    if (x_wrap != y_wrap) {
+        return x_wrap - y_wrap;
+    }
+    if (x->offset != y->offset) {
+        return x->offset < y->offset ? -1 : 1;
+    }
+    return aio_seq_cmp(a, b);                        /* qsort不稳定，以提交顺序定先后 */
+}
+
+static int aio_offset_cmp(const void *a, const void *b) {
+    const struct ddriver_req *x = *(struct ddriver_req * const *)a;
+    const struct ddriver_req *y = *(struct ddriver_req * const *)b;
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/* 按起点排序后只需检查相邻的请求：任意两个请求重叠时，其间相邻的两个也重叠 */
+static int aio_any_overlap(struct ddriver_req **reqs, int n) {
+    struct ddriver_req **tmp = malloc(n * sizeof(struct ddriver_req *));
+    int i, found = 0;
+    memcpy(tmp, reqs, n * sizeof(struct ddriver_req *));
+    qsort(tmp, n, sizeof(struct ddriver_req *), aio_offset_cmp);
+    for (i = 1; i < n && !found; i++) {
+        found = tmp[i]->offset < tmp[i - 1]->offset + (off_t)tmp[i - 1]->size;
+    }
+    free(tmp);
+    return found;
+}
+
+/* 按提交顺序排列的reqs中，从第0个开始与之前的请求都不重叠的最长前缀 */
+static int aio_epoch_len(struct ddriver_req **reqs, int n) {
+    int i, j;
+    if (!aio_any_overlap(reqs, n)) {                 /* 通常整批都不重叠 */
+        return n;
+    }
+    for (i = 1; i < n; i++) {
+        for (j = 0; j < i; j++) {
+            if (reqs[i]->offset < reqs[j]->offset + (off_t)reqs[j]->size &&
+                reqs[j]->offset < reqs[i]->offset + (off_t)reqs[i]->size) {
+                return i;
+            }
+        }
+    }
+    return n;
+}
+
+/* 一段合并后的请求只计一次寻道、旋转与传输延迟 */
+void aio_charge(int fd, struct ddriver_req **run, int n) {
+    INC_SEEKCNT(disk);
+    emulate_rotate(fd, aio_head, run[0]->offset);
+    if (run[0]->is_write) {
+        RW_DELAY(disk, write);
+        INC_WRITECNT(disk);
+    }
+    else {
+        RW_DELAY(disk, read);
+        INC_READCNT(disk);
+    }
+    aio_head = run[n - 1]->offset + run[n - 1]->size;
+}
+
+/* 完成一段合并后的请求，文件方式下一次preadv/pwritev */
+void aio_xfer(int fd, struct ddriver_req **run, int n) {
+    struct iovec iov[AIO_IOV_MAX];
+    off_t  pos = run[0]->offset;
+    int    i, cnt = 0, res = 0;
+    ssize_t ret;
+
+    for (i = 0; i < n; i++) {
+        if (IS_MAPPED(disk)) {
+            if (run[i]->is_write) {
+                memcpy(disk.map_base + run[i]->offset, run[i]->buf, run[i]->size);
+            }
+            else {
+                memcpy(run[i]->buf, disk.map_base + run[i]->offset, run[i]->size);
+            }
+            continue;
+        }
+        iov[cnt].iov_base = run[i]->buf;
+        iov[cnt].iov_len  = run[i]->size;
+        cnt++;
+        if (cnt == AIO_IOV_MAX || i == n - 1) {
+            ret = run[i]->is_write ? pwritev(fd, iov, cnt, pos) : preadv(fd, iov, cnt, pos);
+            if (ret < 0) {
+                res = -EIO;
+            }
+            while (cnt > 0) {
+                pos += iov[--cnt].iov_len;
+            }
+        }
+    }
+    for (i = 0; i < n; i++) {
+        run[i]->result = res < 0 ? res : (int)run[i]->size;
+    }
+}
+
+void *aio_worker_fn(void *arg) {
+    struct ddriver_req **reqs, **epoch;
+    struct ddriver_req *req, *batch;
+    int fd = (int)(intptr_t)arg;
+    int n, m, left, i, j;
+
+    pthread_mutex_lock(&aio_lock);
+    while (1) {
+        while (aio_pending == NULL && !aio_stop) {
+            pthread_cond_wait(&aio_submit_cond, &aio_lock);
+        }
+        if (aio_pending == NULL) {
+            break;
+        }
+        batch = aio_pending;
+        aio_pending = NULL;
+        pthread_mutex_unlock(&aio_lock);
+
+        for (n = 0, req = batch; req != NULL; req = req->next) {
+            n++;
+        }
+        reqs = malloc(n * sizeof(struct ddriver_req *));
+        for (i = 0, req = batch; req != NULL; req = req->next) {
+            reqs[i++] = req;
+        }
+        qsort(reqs, n, sizeof(struct ddriver_req *), aio_seq_cmp);
+        pthread_mutex_lock(&io_lock);
+        for (epoch = reqs, left = n; left > 0; epoch += m, left -= m) {
+            m = aio_epoch_len(epoch, left);
+            qsort(epoch, m, sizeof(struct ddriver_req *), aio_cmp);
+            for (i = 0; i < m; i = j) {
+                for (j = i + 1; j < m && epoch[j]->is_write == epoch[i]->is_write &&
+                                epoch[j]->offset == epoch[j - 1]->offset + (off_t)epoch[j - 1]->size; j++)
+                    ;
+                aio_charge(fd, epoch + i, j - i);
+                if (!IS_URING(disk)) {
+                    aio_xfer(fd, epoch + i, j - i);
+                }
+            }
+            if (IS_URING(disk)) {                   /* 一段一次提交，段内的请求同时在途 */
+                uring_rw(epoch, m);
+            }
+        }
+        pthread_mutex_unlock(&io_lock);
+
+        pthread_mutex_lock(&aio_lock);
+        for (i = 0; i < n; i++) {
+            reqs[i]->done = 1;
+        }
+        pthread_cond_broadcast(&aio_done_cond);
+        free(reqs);
+    }
+    pthread_mutex_unlock(&aio_lock);
+    return NULL;
+}
+
+/* 停止后台线程，队列中已提交的请求先全部完成 */
+void aio_shutdown() {
+    pthread_mutex_lock(&aio_lock);
+    if (!aio_running) {
+        pthread_mutex_unlock(&aio_lock);
+        return;
+    }
+    aio_stop = 1;
+    pthread_cond_signal(&aio_submit_cond);
+    pthread_mutex_unlock(&aio_lock);
+    pthread_join(aio_worker, NULL);
+    aio_running = 0;
+    aio_stop = 0;
+}
+/******************************************************************************
 * SECTION: Global Function Implementation
 *******************************************************************************/
 /**
- * @brief 打开驱动
+ * @brief 按选项打开驱动
  * 
+ * @param path 
+ * @param flags DDRIVER_OPEN_MMAP: 映射整个设备镜像，读写不再经过系统调用，
+ *              close或IOC_REQ_DEVICE_SYNC时msync落盘
+ *              DDRIVER_OPEN_URING: 读写经由io_uring，不可用时退回同步系统调用；
+ *              DDRIVER_OPEN_DIRECT: 另以O_DIRECT打开镜像文件，对齐不满足时退回页缓存。
+ *              同时指定时DDRIVER_OPEN_MMAP优先
  * @return int 文件描述符
  */
-int ddriver_open(char *path) {
+int ddriver_open_flags(const char *path, int flags) {
     int fd, ret = 0;
     char device_path[128] = {0};
     char log_path[128] = {0};
@@ -136,31 +724,75 @@ int ddriver_open(char *path) {
         user_panic("wrong path [%s], should be [%s]", path, device_path);
         return -1;
     }
+    if (load_env_config() < 0) {
+        return -1;
+    }
 
+    if (flags & DDRIVER_OPEN_DIRECT) {
+        flags |= DDRIVER_OPEN_URING;
+    }
+    if (flags & DDRIVER_OPEN_MMAP) {                 /* 映射方式不经过文件读写 */
+        flags &= ~(DDRIVER_OPEN_URING | DDRIVER_OPEN_DIRECT);
+    }
     if (access(device_path, F_OK) == 0) {
-        fd = open(device_path, O_RDWR);
+        fd = open(device_path, O_RDWR | (flags & DDRIVER_OPEN_DIRECT ? O_DIRECT : 0));
     }
     else {
-        fd = open(device_path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+        fd = open(device_path, O_CREAT | O_TRUNC | O_RDWR | (flags & DDRIVER_OPEN_DIRECT ? O_DIRECT : 0), 0644);
     }
     if (fd < 0) {
         user_panic("can't open device: %d", fd);
         return fd;
     }
-    ret = posix_fallocate(fd, 0, CONFIG_DISK_SZ);
-    if (ret < 0) {
+    ret = posix_fallocate(fd, 0, disk.layout_size);
+    if (ret != 0) {                                  /* 返回的是正的错误号 */
         user_panic("low space");
-        return ret;
+        close(fd);
+        return -ENOSPC;
     }
 
+    if (flags & DDRIVER_OPEN_MMAP) {
+        disk.map_base = mmap(NULL, disk.layout_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (disk.map_base == MAP_FAILED) {
+            disk.map_base = NULL;
+            user_panic("can't map device: %s", strerror(errno));
+            close(fd);
+            return -1;
+        }
+        disk.map_pos = 0;
+    }
+    if (flags & DDRIVER_OPEN_URING) {
+        disk.ring = uring_init(fd);
+    }
+    if ((flags & DDRIVER_OPEN_DIRECT) && (!IS_URING(disk) || direct_probe() < 0)) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);    /* 退回到经过页缓存 */
+    }
     debugf = fopen(log_path, "w+");
     if (debugf == NULL) {
         user_panic("can't init log: %s", log_path);
+        if (IS_URING(disk)) {
+            uring_exit(disk.ring);
+            disk.ring = NULL;
+        }
+        if (IS_MAPPED(disk)) {
+            munmap(disk.map_base, disk.layout_size);
+            disk.map_base = NULL;
+        }
+        close(fd);
         return -1;
     }
+    disk.ddriver_fd = fd;
 
     return fd;
 }
+/**
+ * @brief 打开驱动
+ * 
+ * @return int 文件描述符
+ */
+int ddriver_open(const char *path) {
+    return ddriver_open_flags(path, 0);
+}
 /**
  * @brief 关闭驱动
  * 
@@ -168,6 +800,16 @@ int ddriver_open(char *path) {
  * @return int 
  */
 int ddriver_close(int fd) {
+    aio_shutdown();
+    if (IS_URING(disk)) {
+        uring_exit(disk.ring);
+        disk.ring = NULL;
+    }
+    if (IS_MAPPED(disk)) {
+        msync(disk.map_base, disk.layout_size, MS_SYNC);
+        munmap(disk.map_base, disk.layout_size);
+        disk.map_base = NULL;
+    }
     return close(fd) && fclose(debugf);
 }
 /**
@@ -176,26 +818,43 @@ int ddriver_close(int fd) {
  * @param fd 
  * @param offset 
  * @param whence 
- * @return int 
+ * @return off_t 新的磁头位置，设备可超过2GB
  */
-int ddriver_seek(int fd, off_t offset, int whence){
-    int ret = 0;
-    int cur = 0;
+off_t ddriver_seek(int fd, off_t offset, int whence){
+    off_t ret = 0;
+    off_t cur = 0;
 
     if (!IS_ADDR_ALIGN(offset)) {
         user_alert("offset %ld must be aligned to block size %d", 
-                      offset, CONFIG_BLOCK_SZ);
+                      offset, disk.iounit_size);
         return -EINVAL;
     }
 
+    pthread_mutex_lock(&io_lock);
     INC_SEEKCNT(disk);
+    if (IS_MAPPED(disk)) {
+        cur = disk.map_pos;
+        ret = whence == SEEK_SET ? offset :
+              whence == SEEK_CUR ? cur + offset : disk.layout_size + offset;
+        if (ret < 0 || ret > disk.layout_size) {
+            pthread_mutex_unlock(&io_lock);
+            user_panic("seek error: offset %ld out of device", offset);
+            return -EINVAL;
+        }
+        disk.map_pos = ret;
+        emulate_rotate(fd, cur, ret);
+        pthread_mutex_unlock(&io_lock);
+        return ret;
+    }
     cur = lseek(fd, 0, SEEK_CUR);
     ret = lseek(fd, offset, whence);
     if (ret < 0) {
+        pthread_mutex_unlock(&io_lock);
         user_panic("seek error: %s", strerror(errno));
         return ret;
     }
     emulate_rotate(fd, cur, ret);
+    pthread_mutex_unlock(&io_lock);
     return ret;
 }
 /**
@@ -211,11 +870,23 @@ int ddriver_write(int fd, char *buf, size_t size){
     if(res < 0)
         return res;
         
+    pthread_mutex_lock(&io_lock);
     RW_DELAY(disk, write);
-    write(fd, buf, size);
-
-    INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+    if (IS_MAPPED(disk)) {
+        res = map_xfer(buf, size, 1);
+    }
+    else if (IS_URING(disk)) {
+        res = uring_pos_xfer(fd, buf, size, 1);
+    }
+    else {
+        write(fd, buf, size);
+    }
+    if (res == 0)
+        INC_WRITECNT(disk);
+    pthread_mutex_unlock(&io_lock);
+    if (res < 0)
+        return res;
+    return disk.iounit_size;
 }
 /**
  * @brief 
@@ -230,11 +901,165 @@ int ddriver_read(int fd, char *buf, size_t size){
     if(res < 0)
         return res;
 
+    pthread_mutex_lock(&io_lock);
     RW_DELAY(disk, read);
-    read(fd, buf, size);
+    if (IS_MAPPED(disk)) {
+        res = map_xfer(buf, size, 0);
+    }
+    else if (IS_URING(disk)) {
+        res = uring_pos_xfer(fd, buf, size, 0);
+    }
+    else {
+        read(fd, buf, size);
+    }
+    if (res == 0)
+        INC_READCNT(disk);
+    pthread_mutex_unlock(&io_lock);
+    if (res < 0)
+        return res;
+    return disk.iounit_size;
+}
+/**
+ * @brief 批量写入连续的多个IO单元，只计一次传输延迟
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size IO单元大小的整数倍
+ * @return int 写入的字节数
+ */
+int ddriver_write_batch(int fd, char *buf, size_t size){
+    int res = check_valid_batch(size);
+    if(res < 0)
+        return res;
 
-    INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+    pthread_mutex_lock(&io_lock);
+    RW_DELAY(disk, write);
+    if (IS_MAPPED(disk)) {
+        res = map_xfer(buf, size, 1);
+    }
+    else if (IS_URING(disk)) {
+        res = uring_pos_xfer(fd, buf, size, 1);
+    }
+    else if (write(fd, buf, size) != (ssize_t)size) {     /* 多个IO单元可能只传输了一部分 */
+        res = -EIO;
+    }
+    if (res == 0)
+        INC_WRITECNT(disk);
+    pthread_mutex_unlock(&io_lock);
+    if (res < 0)
+        return res;
+    return size;
+}
+/**
+ * @brief 批量读出连续的多个IO单元，只计一次传输延迟
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size IO单元大小的整数倍
+ * @return int 读出的字节数
+ */
+int ddriver_read_batch(int fd, char *buf, size_t size){
+    int res = check_valid_batch(size);
+    if(res < 0)
+        return res;
+
+    pthread_mutex_lock(&io_lock);
+    RW_DELAY(disk, read);
+    if (IS_MAPPED(disk)) {
+        res = map_xfer(buf, size, 0);
+    }
+    else if (IS_URING(disk)) {
+        res = uring_pos_xfer(fd, buf, size, 0);
+    }
+    else if (read(fd, buf, size) != (ssize_t)size) {
+        res = -EIO;
+    }
+    if (res == 0)
+        INC_READCNT(disk);
+    pthread_mutex_unlock(&io_lock);
+    if (res < 0)
+        return res;
+    return size;
+}
+/**
+ * @brief 提交一组异步请求，立即返回
+ * 
+ * @param fd 
+ * @param reqs 请求数组，完成前不能释放或修改
+ * @param n 
+ * @return int 提交的请求数，不合法的请求直接以-EINVAL完成
+ */
+int ddriver_submit(int fd, struct ddriver_req *reqs, int n) {
+    int i;
+
+    pthread_mutex_lock(&aio_lock);
+    if (!aio_running) {
+        if (pthread_create(&aio_worker, NULL, aio_worker_fn, (void *)(intptr_t)fd) != 0) {
+            pthread_mutex_unlock(&aio_lock);
+            user_panic("can't start io worker");
+            return -EAGAIN;
+        }
+        aio_running = 1;
+    }
+    for (i = 0; i < n; i++) {
+        reqs[i].done   = 0;
+        reqs[i].result = 0;
+        if (!IS_ADDR_ALIGN(reqs[i].offset) || reqs[i].size == 0 ||
+            reqs[i].size % disk.iounit_size != 0 || reqs[i].offset < 0 ||
+            reqs[i].offset + (off_t)reqs[i].size > disk.layout_size) {
+            user_alert("bad request at %ld size %ld", reqs[i].offset, reqs[i].size);
+            reqs[i].result = -EINVAL;
+            reqs[i].done   = 1;
+            continue;
+        }
+        reqs[i].seq  = aio_seq++;
+        reqs[i].next = aio_pending;
+        aio_pending  = &reqs[i];
+    }
+    pthread_cond_signal(&aio_submit_cond);
+    pthread_mutex_unlock(&aio_lock);
+    return n;
+}
+/**
+ * @brief 查询已完成的请求数，不阻塞
+ * 
+ * @param fd 
+ * @param reqs 
+ * @param n 
+ * @return int 
+ */
+int ddriver_poll(int fd, struct ddriver_req *reqs, int n) {
+    int i, cnt = 0;
+    IGNORE_ARG(fd);
+    pthread_mutex_lock(&aio_lock);
+    for (i = 0; i < n; i++) {
+        cnt += reqs[i].done;
+    }
+    pthread_mutex_unlock(&aio_lock);
+    return cnt;
+}
+/**
+ * @brief 等待一组请求全部完成
+ * 
+ * @param fd 
+ * @param reqs 
+ * @param n 
+ * @return int 0全部成功，否则为第一个失败请求的错误码
+ */
+int ddriver_wait(int fd, struct ddriver_req *reqs, int n) {
+    int i, ret = 0;
+    IGNORE_ARG(fd);
+    pthread_mutex_lock(&aio_lock);
+    for (i = 0; i < n; i++) {
+        while (!reqs[i].done) {
+            pthread_cond_wait(&aio_done_cond, &aio_lock);
+        }
+        if (ret == 0 && reqs[i].result < 0) {
+            ret = reqs[i].result;
+        }
+    }
+    pthread_mutex_unlock(&aio_lock);
+    return ret;
 }
 /**
  * @brief 
@@ -246,10 +1071,18 @@ int ddriver_read(int fd, char *buf, size_t size){
  */
 int ddriver_ioctl(int fd, unsigned long cmd, void *arg){
     struct ddriver_state state;
+    struct ddriver_config config;
+    int profile, size32, ret = 0;
+
+    pthread_mutex_lock(&io_lock);                     /* 不与进行中的传输交错 */
     switch (cmd)
     {
     case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
-        memcpy(arg, &disk.layout_size, sizeof(int));
+        memcpy(arg, &disk.layout_size, sizeof(int64_t));
+        break;
+    case IOC_REQ_DEVICE_SIZE_INT:                     /* 按旧头文件编译的调用者 */
+        size32 = disk.layout_size > INT32_MAX ? INT32_MAX : (int)disk.layout_size;
+        memcpy(arg, &size32, sizeof(int));
         break;
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
         state.read_cnt = disk.read_cnt;
@@ -258,11 +1091,19 @@ int ddriver_ioctl(int fd, unsigned long cmd, void *arg){
         memcpy(arg, &state, sizeof(struct ddriver_state));
         break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
+        if (IS_MAPPED(disk)) {
+            memset(disk.map_base, 0, disk.layout_size);
+            disk.map_pos = 0;
+            disk.read_cnt = 0;
+            disk.write_cnt = 0;
+            disk.seek_cnt = 0;
+            break;
+        }
         lseek(fd, 0, SEEK_SET);
-        char buf[4096] = {'\0'};
-        for (size_t i = 0; i < CONFIG_DISK_SZ; i += 4096)
+        char buf[4096] __attribute__((aligned(URING_ALIGN))) = {'\0'};   /* O_DIRECT要求对齐 */
+        for (size_t i = 0; i < (size_t)disk.layout_size; i += 4096)
         {
-            write(fd, buf, 4096);
+            write(fd, buf, disk.layout_size - i < 4096 ? disk.layout_size - i : 4096);
         }
         lseek(fd, 0, SEEK_SET);
         disk.read_cnt = 0;
@@ -272,8 +1113,40 @@ int ddriver_ioctl(int fd, unsigned long cmd, void *arg){
     case IOC_REQ_DEVICE_IO_SZ:
         memcpy(arg, &disk.iounit_size, sizeof(int));
         break;
+    case IOC_REQ_DEVICE_SYNC:                         /* Flush to backing file */
+        if (IS_MAPPED(disk)) {
+            ret = msync(disk.map_base, disk.layout_size, MS_SYNC);
+            break;
+        }
+        ret = fsync(fd);
+        break;
+    case IOC_REQ_DEVICE_MAP:                          /* Mapping base, NULL if not mapped */
+        memcpy(arg, &disk.map_base, sizeof(char *));
+        break;
+    case IOC_REQ_DEVICE_GET_CONFIG:                   /* Size and latency model */
+        get_config(&config);
+        memcpy(arg, &config, sizeof(struct ddriver_config));
+        break;
+    case IOC_REQ_DEVICE_SET_CONFIG:
+        memcpy(&config, arg, sizeof(struct ddriver_config));
+        ret = set_config(fd, &config);
+        break;
+    case IOC_REQ_DEVICE_PROFILE:                      /* Switch latencies, keep size and io unit */
+        memcpy(&profile, arg, sizeof(int));
+        if (profile < 0 || profile >= (int)(sizeof(profiles) / sizeof(profiles[0]))) {
+            ret = -EINVAL;
+            break;
+        }
+        get_config(&config);
+        config.track_num = profiles[profile].track_num;
+        config.read_lat  = profiles[profile].read_lat;
+        config.write_lat = profiles[profile].write_lat;
+        config.seek_lat  = profiles[profile].seek_lat;
+        ret = set_config(fd, &config);
+        break;
     default:
         break;
     }
-    return 0;
+    pthread_mutex_unlock(&io_lock);
+    return ret;
 }
\ No newline at end of file
@@ -4,10 +4,16 @@
 #include "ddriver_ctl_user.h"
 #include "stdio.h"
 
-int ddriver_open(char *path);
-int ddriver_seek(int fd, off_t offset, int whence);
+int ddriver_open(const char *path);
+int ddriver_open_flags(const char *path, int flags);
+off_t ddriver_seek(int fd, off_t offset, int whence);
 int ddriver_write(int fd, char *buf, size_t size);
 int ddriver_read(int fd, char *buf, size_t size);
+int ddriver_write_batch(int fd, char *buf, size_t size);
+int ddriver_read_batch(int fd, char *buf, size_t size);
+int ddriver_submit(int fd, struct ddriver_req *reqs, int n);
+int ddriver_poll(int fd, struct ddriver_req *reqs, int n);
+int ddriver_wait(int fd, struct ddriver_req *reqs, int n);
 int ddriver_ioctl(int fd, unsigned long cmd, void *ret);
 int ddriver_close(int fd);
 
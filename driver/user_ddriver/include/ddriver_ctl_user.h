@@ -2,6 +2,8 @@
 #define _DDRIVER_CTL_H_
 
 #include <sys/ioctl.h>   
+#include <sys/types.h>
+#include <stdint.h>
 /******************************************************************************
 * SECTION: IO ctl protocol definitions
 *******************************************************************************/
@@ -13,9 +15,49 @@ struct ddriver_state
     int seek_cnt;
 };
 
-#define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)
+/* 设备大小与延迟模型，延迟单位为us */
+struct ddriver_config
+{
+    int64_t disk_size;                  /* 字节数，可超过2GB */
+    int iounit_size;
+    int track_num;
+    int read_lat;
+    int write_lat;
+    int seek_lat;                       /* 旋转一整圈，跨越的磁道比例乘以该值为寻道延迟 */
+};
+
+/* 异步请求，由ddriver_submit提交，完成后result为传输的字节数或负的错误码 */
+struct ddriver_req
+{
+    off_t  offset;                      /* 设备偏移，按IO单元对齐 */
+    char  *buf;
+    size_t size;                        /* IO单元大小的整数倍 */
+    int    is_write;
+    int    result;
+    int    done;                        /* 以下由驱动维护 */
+    struct ddriver_req *next;
+    unsigned long seq;                  /* 提交顺序，重叠的请求按此顺序完成 */
+};
+
+/* IOC_REQ_DEVICE_PROFILE的参数 */
+#define DDRIVER_PROFILE_HDD     0       /* 读2ms、写1ms、寻道4ms/圈 */
+#define DDRIVER_PROFILE_SSD     1       /* 读100us、写200us、没有寻道开销 */
+#define DDRIVER_PROFILE_NODELAY 2       /* 没有任何延迟 */
+
+#define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int64_t)
+#define IOC_REQ_DEVICE_SIZE_INT _IOR(IOC_MAGIC, 0, int)         /* 旧的以int返回的请求，超过INT_MAX时截断 */
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)
+#define IOC_REQ_DEVICE_SYNC     _IO(IOC_MAGIC, 4)
+#define IOC_REQ_DEVICE_MAP      _IOR(IOC_MAGIC, 5, char *)
+#define IOC_REQ_DEVICE_GET_CONFIG _IOR(IOC_MAGIC, 6, struct ddriver_config)
+#define IOC_REQ_DEVICE_SET_CONFIG _IOW(IOC_MAGIC, 7, struct ddriver_config)
+#define IOC_REQ_DEVICE_PROFILE  _IOW(IOC_MAGIC, 8, int)
+
+/* ddriver_open_flags的选项 */
+#define DDRIVER_OPEN_MMAP       0x1     /* 映射整个设备镜像，读写变为内存拷贝 */
+#define DDRIVER_OPEN_URING      0x2     /* 经由io_uring读写，批量请求同时在途 */
+#define DDRIVER_OPEN_DIRECT     0x4     /* 以O_DIRECT打开镜像文件，隐含DDRIVER_OPEN_URING */
 
 #endif
\ No newline at end of file
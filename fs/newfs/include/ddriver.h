@@ -10,7 +10,16 @@
  * @param path ddriver设备路径
  * @return int 0成功，否则失败
  */
-int ddriver_open(char *path);
+int ddriver_open(const char *path);
+
+/**
+ * @brief 按选项打开ddriver设备
+ * 
+ * @param path ddriver设备路径
+ * @param flags DDRIVER_OPEN_MMAP等选项
+ * @return int 0成功，否则失败
+ */
+int ddriver_open_flags(const char *path, int flags);
 
 /**
  * @brief 移动ddriver磁盘头
@@ -18,9 +27,9 @@ int ddriver_open(char *path);
  * @param fd ddriver设备handler
  * @param offset 移动到的位置，注意要和设备IO单位对齐
  * @param whence SEEK_SET即可
- * @return int 0成功，否则失败
+ * @return off_t 新的位置，失败返回负数
  */
-int ddriver_seek(int fd, off_t offset, int whence);
+off_t ddriver_seek(int fd, off_t offset, int whence);
 
 /**
  * @brief 写入数据
@@ -42,6 +51,56 @@ int ddriver_write(int fd, char *buf, size_t size);
  */
 int ddriver_read(int fd, char *buf, size_t size);
 
+/**
+ * @brief 批量写入从当前磁盘头开始的连续多个IO单元，只计一次传输
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的数据Buf
+ * @param size 要写入的数据大小，必须是设备IO单位的整数倍
+ * @return int 写入的字节数，负数表示失败
+ */
+int ddriver_write_batch(int fd, char *buf, size_t size);
+
+/**
+ * @brief 批量读出从当前磁盘头开始的连续多个IO单元，只计一次传输
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要读出的数据Buf
+ * @param size 要读出的数据大小，必须是设备IO单位的整数倍
+ * @return int 读出的字节数，负数表示失败
+ */
+int ddriver_read_batch(int fd, char *buf, size_t size);
+
+/**
+ * @brief 提交一组异步请求，立即返回。后台线程按磁头位置排序并合并相邻的请求
+ * 
+ * @param fd ddriver设备handler
+ * @param reqs 请求数组，完成前不能释放或修改
+ * @param n 请求数
+ * @return int 提交的请求数，负数表示失败
+ */
+int ddriver_submit(int fd, struct ddriver_req *reqs, int n);
+
+/**
+ * @brief 查询一组请求中已完成的个数，不阻塞
+ * 
+ * @param fd ddriver设备handler
+ * @param reqs 请求数组
+ * @param n 请求数
+ * @return int 已完成的请求数
+ */
+int ddriver_poll(int fd, struct ddriver_req *reqs, int n);
+
+/**
+ * @brief 等待一组请求全部完成
+ * 
+ * @param fd ddriver设备handler
+ * @param reqs 请求数组
+ * @param n 请求数
+ * @return int 0全部成功，否则为第一个失败请求的错误码
+ */
+int ddriver_wait(int fd, struct ddriver_req *reqs, int n);
+
 /**
  * @brief ddriver IO控制
  * 
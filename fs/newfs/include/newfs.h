@@ -11,6 +11,7 @@
 #include <stddef.h>
 #include "ddriver.h"
 #include "errno.h"
+#include <pthread.h>
 #include "types.h"
 #include "stdint.h"
 
@@ -27,8 +28,13 @@
 *******************************************************************************/
 char* 			   newfs_get_fname(const char* path);
 int 			   newfs_calc_lvl(const char * path);
-int 			   newfs_driver_read(int offset, uint8_t *out_content, int size);
-int 			   newfs_driver_write(int offset, uint8_t *in_content, int size);
+int 			   newfs_driver_read(int64_t offset, uint8_t *out_content, int size);
+int 			   newfs_driver_write(int64_t offset, uint8_t *in_content, int size);
+int 			   newfs_dev_read(int64_t offset, uint8_t *out_content, int size);
+int 			   newfs_dev_write(int64_t offset, uint8_t *in_content, int size);
+const uint8_t* 	   newfs_dev_map(int64_t offset, int size);
+int 			   newfs_driver_submit(struct newfs_dev_io* ios, int n);
+int 			   newfs_dev_submit(struct newfs_dev_io* ios, int n);
 
 
 int 			   newfs_mount(struct custom_options options);
@@ -38,14 +44,126 @@ int 			   newfs_alloc_dentry(struct newfs_inode * inode, struct newfs_dentry * d
 int 			   newfs_drop_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry);
 struct newfs_inode*  newfs_alloc_inode(struct newfs_dentry * dentry);
 int 			   newfs_sync_inode(struct newfs_inode * inode);
+int 			   newfs_sync_data(struct newfs_inode * inode);
 int 			   newfs_drop_inode(struct newfs_inode * inode);
+void 			   newfs_get_dir(struct newfs_inode * inode);
+void 			   newfs_put_dir(struct newfs_inode * inode);
 struct newfs_inode*  newfs_read_inode(struct newfs_dentry * dentry, int ino);
+void 			   newfs_free_inode(struct newfs_inode * inode);
 struct newfs_dentry* newfs_get_dentry(struct newfs_inode * inode, int dir);
+int 			   newfs_data_resize(struct newfs_inode* inode, int old_nums);
+int 			   newfs_data_fault(struct newfs_inode* inode, int64_t offset, int size, boolean is_write);
+void 			   newfs_data_set_dirty(struct newfs_inode* inode, int blk);
+void 			   newfs_map_dirty(uint8_t* map_dirty, int start, int n);
+int 			   newfs_sync_fs();
+int 			   newfs_sync_meta();
 int					 newfs_drop_inode(struct newfs_inode * inode);
 int 				 newfs_drop_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry);
 
 struct newfs_dentry* newfs_lookup(const char * path, boolean * is_find, boolean* is_root);
 
+/******************************************************************************
+* SECTION: newfs_bmap.c
+*******************************************************************************/
+int 			   newfs_bmap_load(struct newfs_inode* inode, struct newfs_inode_d* inode_d);
+int 			   newfs_bmap_sync(struct newfs_inode* inode, struct newfs_inode_d* inode_d);
+int 			   newfs_bmap_credits(struct newfs_inode* inode, int from, int to);
+int 			   newfs_bmap_grow(struct newfs_inode* inode, int nblks);
+void 			   newfs_bmap_truncate(struct newfs_inode* inode, int nblks);
+void 			   newfs_bmap_free(struct newfs_inode* inode);
+int 			   newfs_bmap_extent(struct newfs_inode* inode, int lblk, int max);
+
+/******************************************************************************
+* SECTION: newfs_dir.c
+*******************************************************************************/
+int 			   newfs_dindex_insert(struct newfs_inode* inode, struct newfs_dentry* dentry);
+void 			   newfs_dindex_remove(struct newfs_inode* inode, struct newfs_dentry* dentry);
+struct newfs_dentry* newfs_dindex_find(struct newfs_inode* inode, const char* fname);
+void 			   newfs_dindex_free(struct newfs_inode* inode);
+uint32_t 		   newfs_name_hash(const char* fname);
+
+/******************************************************************************
+* SECTION: newfs_dcache.c
+*******************************************************************************/
+void 			   newfs_dcache_init();
+struct newfs_dentry* newfs_dcache_lookup(const char* path, boolean* is_find, int* gen);
+void 			   newfs_dcache_insert(const char* path, struct newfs_dentry* dentry, boolean is_find, int gen);
+void 			   newfs_dcache_invalidate_neg();
+void 			   newfs_dcache_invalidate(const char* path);
+void 			   newfs_dcache_destroy();
+
+/******************************************************************************
+* SECTION: newfs_bitmap.c
+*******************************************************************************/
+int 			   newfs_bitmap_alloc(uint8_t* map, int nbits, int* hint);
+int 			   newfs_bitmap_alloc_run(uint8_t* map, int nbits, int* hint, int n);
+int 			   newfs_bitmap_extend(uint8_t* map, int nbits, int start, int max);
+int 			   newfs_bitmap_count(uint8_t* map, int nbits);
+void 			   newfs_bitmap_copy(uint8_t* dst, uint8_t* map, int bytes);
+void 			   newfs_bitmap_free(uint8_t* map, int idx);
+void 			   newfs_bitmap_free_batch(uint8_t* map, const int* idxs, int n);
+int* 			   newfs_bitmap_hint(int which, int base, int nbits);
+
+/******************************************************************************
+* SECTION: newfs_group.c
+*******************************************************************************/
+int 			   newfs_group_ino_cnt(int grp);
+int 			   newfs_group_data_cnt(int grp);
+void 			   newfs_group_pad();
+int 			   newfs_group_ino_goal(struct newfs_dentry* dentry);
+int 			   newfs_group_data_goal(struct newfs_inode* inode);
+int* 			   newfs_group_hint(int which, int grp);
+
+/******************************************************************************
+* SECTION: newfs_cache.c
+*******************************************************************************/
+int 			   newfs_cache_init(int capacity);
+int 			   newfs_cache_read(int64_t offset, uint8_t *out_content, int size);
+int 			   newfs_cache_write(int64_t offset, uint8_t *in_content, int size);
+int 			   newfs_cache_read_batch(struct newfs_dev_io* ios, int n);
+int 			   newfs_cache_flush();
+void 			   newfs_cache_destroy();
+
+/******************************************************************************
+* SECTION: newfs_journal.c
+*******************************************************************************/
+int 			   newfs_journal_init(boolean is_init);
+void 			   newfs_journal_destroy();
+void 			   newfs_journal_begin();
+int 			   newfs_journal_commit();
+void 			   newfs_journal_abort();
+int 			   newfs_journal_undo_flag(int* flag, int mask);
+int 			   newfs_journal_undo_map(uint8_t* map_dirty, int grp);
+int 			   newfs_journal_undo_data(struct newfs_inode* inode, int blk, int len);
+int 			   newfs_journal_reserve(int nblks);
+boolean 		   newfs_journal_need_commit();
+void 			   newfs_journal_release();
+int 			   newfs_journal_checkpoint();
+void 			   newfs_journal_revoke(int blk);
+int 			   newfs_meta_write(int64_t offset, uint8_t *in_content, int size);
+
+/******************************************************************************
+* SECTION: newfs_lock.c
+*******************************************************************************/
+void 			   newfs_ns_rdlock();
+void 			   newfs_ns_wrlock();
+void 			   newfs_ns_unlock();
+void 			   newfs_inode_rdlock(struct newfs_inode* inode);
+void 			   newfs_inode_wrlock(struct newfs_inode* inode);
+void 			   newfs_inode_unlock(struct newfs_inode* inode);
+struct newfs_inode*  newfs_load_inode(struct newfs_dentry* dentry);
+void 			   newfs_dirty_add(int delta);
+
+/******************************************************************************
+* SECTION: newfs_flush.c
+*******************************************************************************/
+int 			   newfs_flush_all();
+int 			   newfs_flush_commit();
+int 			   newfs_flusher_start();
+void 			   newfs_flusher_stop();
+void 			   newfs_flusher_kick();
+boolean 		   newfs_flush_retry(int* ret);
+
 /******************************************************************************
 * SECTION: newfs.c
 *******************************************************************************/
@@ -56,6 +174,8 @@ int   			   newfs_getattr(const char *, struct stat *);
 int   			   newfs_readdir(const char *, void *, fuse_fill_dir_t, off_t,
 						                struct fuse_file_info *);
 int   			   newfs_mknod(const char *, mode_t, dev_t);
+int   			   newfs_symlink(const char *, const char *);
+int   			   newfs_readlink(const char *, char *, size_t);
 int   			   newfs_write(const char *, const char *, size_t, off_t,
 					                  struct fuse_file_info *);
 int   			   newfs_read(const char *, char *, size_t, off_t,
@@ -69,6 +189,10 @@ int   			   newfs_truncate(const char *, off_t);
 			
 int   			   newfs_open(const char *, struct fuse_file_info *);
 int   			   newfs_opendir(const char *, struct fuse_file_info *);
+int   			   newfs_releasedir(const char *, struct fuse_file_info *);
+int   			   newfs_flush(const char *, struct fuse_file_info *);
+int   			   newfs_fsync(const char *, int, struct fuse_file_info *);
+int   			   newfs_fsyncdir(const char *, int, struct fuse_file_info *);
 /******************************************************************************
 * SECTION: newfs_debug.c
 *******************************************************************************/
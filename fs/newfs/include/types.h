@@ -4,6 +4,13 @@
 typedef int  boolean;
 struct custom_options {
 	const char*        device;
+	int                cache_blks;                   /* 块缓存容量（逻辑块数），0表示不使用缓存 */
+	int                flush_interval;               /* 后台回写间隔（秒），0表示不启动回写线程 */
+	int                flush_dirty_kb;               /* 脏数据超过该值（KB）时提前回写，0表示只按间隔 */
+	int                inode_ratio;                  /* 格式化时每多少字节的空间分配一个inode */
+	int                mmap;                         /* 以内存映射方式打开设备，块缓存随之关闭 */
+	int                uring;                        /* 设备经由io_uring读写，批量请求同时在途 */
+	int                direct;                       /* 以O_DIRECT打开设备镜像，隐含uring */
 };
 
 typedef enum newfs_file_type {
@@ -41,10 +48,18 @@ typedef enum newfs_file_type {
 #define NEWFS_ERROR_UNSUPPORTED   ENXIO
 #define NEWFS_ERROR_IO            EIO     /* Error Input/Output */
 #define NEWFS_ERROR_INVAL         EINVAL  /* Invalid Args */
+#define NEWFS_ERROR_NOTDIR        ENOTDIR
+#define NEWFS_ERROR_NOTEMPTY      ENOTEMPTY
+#define NEWFS_ERROR_FBIG          EFBIG
+#define NEWFS_ERROR_NAMETOOLONG   ENAMETOOLONG
+#define NEWFS_ERROR_AGAIN         EAGAIN  /* 日志额度不足，提交之后重试 */
 
 #define NEWFS_MAX_FILE_NAME       128
 #define NEWFS_INODE_PER_FILE      1
-#define NEWFS_DATA_PER_FILE       6
+#define NEWFS_DATA_PER_FILE       6                      /* 直接块指针数 */
+#define NEWFS_IND_BLK             NEWFS_DATA_PER_FILE    /* 一级间接块指针下标 */
+#define NEWFS_DIND_BLK            (NEWFS_IND_BLK + 1)    /* 二级间接块指针下标 */
+#define NEWFS_N_BLKS              (NEWFS_DIND_BLK + 1)
 #define NEWFS_DEFAULT_PERM        0777
 
 #define NEWFS_IOC_MAGIC           'S'
@@ -52,6 +67,37 @@ typedef enum newfs_file_type {
 
 #define NEWFS_FLAG_BUF_DIRTY      0x1
 #define NEWFS_FLAG_BUF_OCCUPY     0x2
+
+#define NEWFS_FLAG_INODE_DIRTY    0x1    /* inode记录需要写回 */
+#define NEWFS_FLAG_BMAP_DIRTY     0x2    /* 间接块需要写回 */
+#define NEWFS_FLAG_DENTRY_DIRTY   0x4    /* 目录项块需要写回 */
+#define NEWFS_FLAG_INODE_DEAD     0x8    /* 已删除，等最后一个目录游标关闭后释放 */
+
+#define NEWFS_HINT_INO            0      /* 每线程分配起点：索引节点位图 */
+#define NEWFS_HINT_DATA           1      /* 每线程分配起点：数据块位图 */
+#define NEWFS_HINT_CNT            2
+
+#define NEWFS_VERSION             7    /* 1: 仅6个直接块; 2: 增加一级、二级间接块; 3: 增加元数据日志区; 4: 块组;
+                                          5: 按设备大小确定块组与inode表，超级块中的偏移为64位;
+                                          6: 文件大小、设备大小与日志中的块号为64位;
+                                          7: 变长目录项记录，精简inode记录，符号链接目标内联或存于数据块 */
+
+#define NEWFS_GROUP_MIN_BLKS      1024 /* 块组的最小块数，最后一组为剩余的块 */
+#define NEWFS_GROUP_SPLIT         4    /* 块组数至少为4（设备足够大时） */
+#define NEWFS_GROUP_MAP_BLKS      2    /* 每组开头的inode位图与数据位图各占1块 */
+
+#define NEWFS_JOURNAL_BLKS        64   /* 日志区块数，第0块为日志头 */
+#define NEWFS_JOURNAL_MAGIC       0x4e464a4c
+#define NEWFS_JOURNAL_DESC        1    /* 事务描述块 */
+#define NEWFS_JOURNAL_COMMIT      2    /* 事务提交块 */
+
+#define NEWFS_DEFAULT_CACHE_BLKS  64
+#define NEWFS_DEFAULT_FLUSH_INTERVAL 5
+#define NEWFS_DEFAULT_FLUSH_DIRTY_KB 1024
+#define NEWFS_DEFAULT_INODE_RATIO 8192
+#define NEWFS_DCACHE_BUCKETS      1024
+#define NEWFS_DCACHE_MAX          4096
+#define NEWFS_LOAD_STRIPES        64     /* 按需装载inode的分段锁个数 */
 /******************************************************************************
 * SECTION: Macro Function
 *******************************************************************************/
@@ -70,104 +116,153 @@ typedef enum newfs_file_type {
 #define NEWFS_ASSIGN_FNAME(psfs_dentry, _fname) \
 (memcpy(psfs_dentry->fname, _fname, strlen(_fname)))
 
-#define NEWFS_INODES_PER_BLK                16
+#define NEWFS_INODES_PER_BLK              ((int)(NEWFS_BLK_SZ() / sizeof(struct newfs_inode_d)))
+/* inode号与数据块号的高位是块组号，低位是组内下标，每组占位图的一整块 */
+#define NEWFS_GROUP_OF(idx)               ((idx) / NEWFS_MAP_BITS_PER_BLK)
+#define NEWFS_GROUP_IDX(idx)              ((idx) % NEWFS_MAP_BITS_PER_BLK)
+#define NEWFS_GROUP_BASE(grp)             ((grp) * NEWFS_MAP_BITS_PER_BLK)
+#define NEWFS_GROUP_OFS(grp)              NEWFS_BLKS_SZ((int64_t)(grp) * newfs_super.group_blks)  /* 相对0号组中同一区域 */
 #define NEWFS_INO_OFS(ino) \
-    (newfs_super.ino_offset + ((ino) / NEWFS_INODES_PER_BLK) * NEWFS_BLK_SZ() + ((ino) % NEWFS_INODES_PER_BLK) * sizeof(struct newfs_inode_d))
-#define NEWFS_DATA_OFS(ino)               (newfs_super.data_offset + NEWFS_BLKS_SZ(ino))
+    (newfs_super.ino_offset + NEWFS_GROUP_OFS(NEWFS_GROUP_OF(ino)) + \
+     (NEWFS_GROUP_IDX(ino) / NEWFS_INODES_PER_BLK) * NEWFS_BLK_SZ() + \
+     (NEWFS_GROUP_IDX(ino) % NEWFS_INODES_PER_BLK) * sizeof(struct newfs_inode_d))
+#define NEWFS_DATA_OFS(blk) \
+    (newfs_super.data_offset + NEWFS_GROUP_OFS(NEWFS_GROUP_OF(blk)) + NEWFS_BLKS_SZ(NEWFS_GROUP_IDX(blk)))
+
+#define NEWFS_DATA_RES(pinode, blk)       ((pinode)->data_res[(blk) / UINT8_BITS] & (0x1 << ((blk) % UINT8_BITS)))
+#define NEWFS_DATA_DIRTY(pinode, blk)     ((pinode)->data_dirty[(blk) / UINT8_BITS] & (0x1 << ((blk) % UINT8_BITS)))
+#define NEWFS_MAP_BITS_PER_BLK            (NEWFS_BLK_SZ() * UINT8_BITS)
 
 #define NEWFS_IS_DIR(pinode)              (pinode->dentry->ftype == NEWFS_DIR)
 #define NEWFS_IS_REG(pinode)              (pinode->dentry->ftype == NEWFS_REG_FILE)
 #define NEWFS_IS_SYM_LINK(pinode)         (pinode->dentry->ftype == NEWFS_SYM_LINK)
-#define NEWFS_DENTRYS_PER_BLK             (NEWFS_BLK_SZ() / sizeof(struct newfs_dentry_d))
+/* 目录项记录长度：定长头部加名字（不含'\0'），按4字节对齐；记录不跨块 */
+#define NEWFS_DENTRY_D_LEN(name_len)      NEWFS_ROUND_UP((int)sizeof(struct newfs_dentry_d) + (name_len), 4)
+/* 不超过块指针区大小的符号链接目标直接存放在inode记录的块指针区 */
+#define NEWFS_SYMLINK_INLINE_MAX          ((int)sizeof(((struct newfs_inode_d*)0)->blk_pointers))
+#define NEWFS_PTRS_PER_BLK                ((int)(NEWFS_BLK_SZ() / sizeof(int)))
+#define NEWFS_MAX_FILE_BLKS               (NEWFS_DATA_PER_FILE + NEWFS_PTRS_PER_BLK + \
+                                           NEWFS_PTRS_PER_BLK * NEWFS_PTRS_PER_BLK)
 
 
 //超级块
 struct newfs_super {
     uint32_t magic_num;             //幻数
     int driver_fd;              //设备文件描述符
+    uint8_t* dev_map;           //设备镜像的内存映射，未映射时为NULL
 
     boolean is_mounted;         //是否被挂载
+    boolean sb_dirty;           //超级块是否需要写回
+    int dirty_blks;             //文件数据中的脏块数
 
     int blk_size;               //逻辑块大小
     int io_size;                //IO大小
-    int disk_size;              //磁盘大小
-    int usage_size;             //已使用大小
+    int64_t disk_size;          //磁盘大小
+    int64_t usage_size;         //已使用大小
 
-    int sb_offset;              // 超级块于磁盘中的偏移，通常默认为0
+    int64_t sb_offset;          // 超级块于磁盘中的偏移，通常默认为0
     int sb_blks;                // 超级块于磁盘中的块数，通常默认为1
 
-    int ino_map_offset;         //索引节点位图的偏移
-    int ino_map_blks;           //索引节点位图占用逻辑块数量
+    int group_cnt;              //块组数
+    int group_blks;             //每个块组占用逻辑块数量（最后一组可能更少）
+    int group_inos;             //每个块组的inode数
+
+    int64_t ino_map_offset;     //0号组索引节点位图的偏移
+    int ino_map_blks;           //索引节点位图占用逻辑块数量，每组1块
     uint8_t* ino_map;
+    uint8_t* ino_map_dirty;     //索引节点位图每个逻辑块是否需要写回
 
-    int data_map_offset;        //数据块位图偏移
-    int data_map_blks;          //数据块位图占用逻辑块数量
+    int64_t data_map_offset;    //0号组数据块位图偏移
+    int data_map_blks;          //数据块位图占用逻辑块数量，每组1块
     uint8_t* data_map;
+    uint8_t* data_map_dirty;    //数据块位图每个逻辑块是否需要写回
 
-    int ino_offset;             //索引节点的偏移
-    int ino_blks;               //索引节点占用逻辑块数量
+    int64_t journal_offset;     //日志区偏移
+    int journal_blks;           //日志区占用逻辑块数量
 
-    int data_offset;            //数据块偏移
-    int data_blks;             //数据块占用逻辑块数量
+    int64_t ino_offset;         //0号组索引节点的偏移
+    int ino_blks;               //每组索引节点占用逻辑块数量
+
+    int64_t data_offset;        //0号组数据块偏移
+    int data_blks;             //数据块占用逻辑块数量，所有组之和
 
     struct newfs_dentry* root_dentry; //根目录索引
-    int ino_max;                // 最大支持inode数
-    int data_max;              //逻辑块块数
+    int ino_max;                // inode位图位数，含各组末尾不可用的位
+    int data_max;              //数据块位图位数，含各组末尾不可用的位
 };
 
 struct newfs_super_d{
 
     uint32_t magic_num;             //幻数
+    uint32_t version;               //磁盘格式版本，见NEWFS_VERSION
 
     int blks_size;              // 逻辑块大小
     int io_size;                //IO大小
-    int disk_size;              //磁盘大小
-    int usage_size;             //已使用大小
+    int64_t disk_size;          //磁盘大小
+    int64_t usage_size;         //已使用大小
 
-    int sb_offset;              // 超级块于磁盘中的偏移，通常默认为0
+    int64_t sb_offset;          // 超级块于磁盘中的偏移，通常默认为0
     int sb_blks;                // 超级块于磁盘中的块数，通常默认为1
 
-    int ino_map_offset;         //索引节点位图的偏移
-    int ino_map_blks;           //索引节点位图占用逻辑块数量
+    int group_cnt;              //块组数
+    int group_blks;             //每个块组占用逻辑块数量（最后一组可能更少）
+    int group_inos;             //每个块组的inode数
+
+    int64_t ino_map_offset;     //0号组索引节点位图的偏移
+    int ino_map_blks;           //索引节点位图占用逻辑块数量，每组1块
 
-    int data_map_offset;        //数据块位图偏移
+    int64_t data_map_offset;    //0号组数据块位图偏移
     int data_map_blks;          //数据块位图占用逻辑块数量
 
-    int ino_offset;             //索引节点的偏移
-    int ino_blks;               //索引节点占用逻辑块数量
+    int64_t journal_offset;     //日志区偏移
+    int journal_blks;           //日志区占用逻辑块数量
+
+    int64_t ino_offset;         //0号组索引节点的偏移
+    int ino_blks;               //每组索引节点占用逻辑块数量
 
-    int data_offset;            //数据块偏移
-    int data_blks;              //数据块占用逻辑块数量
+    int64_t data_offset;        //0号组数据块偏移
+    int data_blks;              //数据块占用逻辑块数量，所有组之和
 
-    int ino_max;                // 最大支持inode数
-    int data_max;              //逻辑块块数
+    int ino_max;                // inode位图位数
+    int data_max;              //数据块位图位数
 
 };
 
 struct newfs_inode {
     uint32_t           ino;                           // 在inode位图中的下标
-    int                size;                          /* 文件已占用空间 */
-    int                blk_pointers[NEWFS_DATA_PER_FILE]; /*数据块地址指针*/
-    uint8_t*           data;     /* 数据块内容指针（可固定分配）*/
+    int64_t            size;                          /* 文件已占用空间 */
+    int*               blk_map;                       /* 逻辑块号到数据块号的映射，长度blk_map_cap */
+    int                blk_map_cap;
+    int                ind_blk;                       /* 一级间接块，-1表示未分配 */
+    int                dind_blk;                      /* 二级间接块，-1表示未分配 */
+    int*               dind_map;                      /* 二级间接块的内容，即其下各一级间接块 */
+    uint8_t*           data;     /* 数据块内容指针，随allocated_nums增长，首次读写时才分配 */
+    uint8_t*           data_res;                      /* 驻留位图，第i位表示data中第i块已从磁盘读入 */
+    uint8_t*           data_dirty;                    /* 脏块位图，第i位表示data中第i块需要写回 */
+    int                flag;                          /* NEWFS_FLAG_INODE_DIRTY | BMAP_DIRTY | DENTRY_DIRTY */
     int                link;                          /* 链接数，默认为1 */
     struct newfs_dentry* dentry;                        /* 指向该inode的目录dentrt或者文件dentry */
     struct newfs_dentry* dentrys;                       /* 如果是该inode是目录，dentrys指向其子目录的dentray链表的首个 */
     char               target_path[NEWFS_MAX_FILE_NAME];/* store traget path when it is a symlink */
     NEWFS_FILE_TYPE    ftype;
     int                dir_cnt;                      // 如果是目录类型文件，下面有几个目录项
-    int                allocated_nums;
+    int                dir_bytes;                    /* 目录项记录依次排入各块后的末尾位置，决定目录所需的块数 */
+    int                allocated_nums;                /* 已分配的数据块数（不含间接块） */
+    struct newfs_dir_index* dindex;                  /* 目录项名字哈希索引，仅目录使用 */
+    int                dir_ver;                      /* 目录项被删除时递增，用于校验readdir游标 */
+    int                open_cnt;                     /* 引用该目录的readdir游标数，非0时drop_inode推迟释放 */
+    pthread_rwlock_t   lock;                         /* 目录：保护目录项；普通文件：保护size、块映射与data */
+    pthread_mutex_t    fault_lock;                   /* 读锁下多个读者按需读入块时互斥，保护data_res */
 };
 
+/* 磁盘inode记录，只含定长字段，不存放内存指针 */
 struct newfs_inode_d {
+    int64_t            size;                          /* 文件已占用空间，符号链接为目标路径长度 */
     uint32_t           ino;                           // 在inode位图中的下标
-    int                size;                          /* 文件已占用空间 */
-    int                blk_pointers[NEWFS_DATA_PER_FILE];
-    uint8_t*           data;    /* 数据块指针（可固定分配）*/
+    int32_t            ftype;                         /* NEWFS_FILE_TYPE */
     int                link;                          /* 链接数，默认为1 */
-    char               target_path[NEWFS_MAX_FILE_NAME];/* store traget path when it is a symlink */
-    NEWFS_FILE_TYPE    ftype;
-    int                dir_cnt;                      // 如果是目录类型文件，下面有几个目录项
     int                allocated_nums;
+    int                blk_pointers[NEWFS_N_BLKS];    /* 直接块、一级间接块、二级间接块；短符号链接的目标路径 */
 };
 
 
@@ -180,12 +275,83 @@ struct newfs_dentry {
     struct newfs_inode*  inode;                    /*该目录项对应的inode*/
 };
 
+/* 磁盘目录项记录，与ext2相同为变长记录：rec_len为到下一条记录的距离，块内最后一条记录
+ * 延伸到块尾；name_len为0的记录是空闲空间（0号inode是根目录，不能用ino标记空闲） */
 struct newfs_dentry_d {
-    char                fname[MAX_NAME_LEN];        /*该文件的名字*/
     uint32_t            ino;                       /*该目录项指向的ino节点*/
-    NEWFS_FILE_TYPE     ftype;                     /*该目录文件或者普通文件*/
+    uint16_t            rec_len;                   /* 记录长度，含其后的空闲空间 */
+    uint8_t             name_len;                  /* 名字长度，不含'\0' */
+    uint8_t             ftype;                     /*该目录文件或者普通文件*/
+    char                fname[];                   /*该文件的名字，不以'\0'结尾*/
+};
+
+/* 目录的名字哈希索引，开放寻址，线性探测 */
+struct newfs_dir_index {
+    struct newfs_dentry** slots;                  /* NULL为空槽，NEWFS_DINDEX_TOMB为已删除 */
+    int                   capacity;               /* 槽数，2的幂 */
+    int                   used;                   /* 有效项与墓碑之和 */
+    int                   cnt;                    /* 有效项数 */
+};
+
+/* opendir时建立的目录游标，保存在fuse_file_info的fh中 */
+struct newfs_dir_cursor {
+    struct newfs_inode*        dir;               /* 被遍历的目录，open_cnt保证其在游标关闭前不被释放 */
+    struct newfs_dentry*       next;              /* 下一个要返回的目录项 */
+    off_t                      offset;            /* next在目录项链表中的序号 */
+    int                        dir_ver;           /* 建立游标时目录的dir_ver */
+};
+
+/* 路径到目录项的缓存项，is_find为FALSE时是负项，dentry为路径上最深的有效目录项 */
+struct newfs_dcache_entry {
+    char*                      path;
+    uint32_t                   hash;
+    struct newfs_dentry*       dentry;
+    boolean                    is_find;
+    int                        neg_gen;           /* 负项建立时的代数，代数变化后负项失效 */
+    struct newfs_dcache_entry* next;
+};
+
+/* 日志头，位于日志区第0块 */
+struct newfs_journal_super {
+    uint32_t           magic;
+    uint32_t           seq;                       /* 第一个未检查点事务的序号 */
+    int                start;                     /* 第一个未检查点事务所在的日志块 */
 };
 
+/* 事务描述块，其后依次是cnt个块镜像与一个提交块 */
+struct newfs_journal_desc {
+    uint32_t           magic;
+    uint32_t           type;                      /* NEWFS_JOURNAL_DESC */
+    uint32_t           seq;
+    int                cnt;
+    int64_t            blknos[];                  /* 各块镜像在磁盘上的逻辑块号 */
+};
+
+/* 事务提交块，checksum覆盖描述块与全部块镜像 */
+struct newfs_journal_commit {
+    uint32_t           magic;
+    uint32_t           type;                      /* NEWFS_JOURNAL_COMMIT */
+    uint32_t           seq;
+    uint32_t           checksum;
+};
+
+/* 一次批量提交中的一个设备请求，见newfs_dev_submit */
+struct newfs_dev_io {
+    int64_t            offset;                    /* 设备上的字节偏移 */
+    uint8_t*           buf;
+    int                size;
+    boolean            is_write;
+};
+
+/* 块缓存中的一个缓冲区，以逻辑块号为键 */
+struct newfs_buf {
+    int64_t            blkno;                     /* 缓存的逻辑块号 */
+    int                flag;                      /* NEWFS_FLAG_BUF_DIRTY | NEWFS_FLAG_BUF_OCCUPY */
+    uint8_t*           data;                      /* 一个逻辑块大小的数据 */
+    struct newfs_buf*  prev;                      /* LRU链表，越靠近表头越新 */
+    struct newfs_buf*  next;
+    struct newfs_buf*  hnext;                     /* 哈希桶链表 */
+};
 
 static inline struct newfs_dentry* new_dentry(char * fname, NEWFS_FILE_TYPE ftype) {
     struct newfs_dentry * dentry = (struct newfs_dentry *)malloc(sizeof(struct newfs_dentry));
@@ -196,5 +362,6 @@ static inline struct newfs_dentry* new_dentry(char * fname, NEWFS_FILE_TYPE ftyp
     dentry->inode   = NULL;
     dentry->parent  = NULL;
     dentry->brother = NULL;                                               
+    return dentry;
 }
 #endif /* _TYPES_H_ */
\ No newline at end of file
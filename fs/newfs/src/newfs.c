@@ -13,32 +13,219 @@
 *******************************************************************************/
 static const struct fuse_opt option_spec[] = {		/* 用于FUSE文件系统解析参数 */
 	OPTION("--device=%s", device),
+	OPTION("--cache_blks=%d", cache_blks),
+	OPTION("--flush_interval=%d", flush_interval),
+	OPTION("--flush_dirty_kb=%d", flush_dirty_kb),
+	OPTION("--inode_ratio=%d", inode_ratio),
+	OPTION("--mmap", mmap),
+	OPTION("--uring", uring),
+	OPTION("--direct", direct),
 	FUSE_OPT_END
 };
 
 struct custom_options newfs_options;			 /* 全局选项 */
 struct newfs_super newfs_super; 
+/******************************************************************************
+* SECTION: 加锁入口
+* 按newfs_lock.c中的模型获取名字空间锁：不释放目录项与inode的操作共享持有，其余独占持有。
+* 各操作的实现只加目录、文件inode一级的锁，以便rename等操作在内部互相调用。
+* 改动元数据的操作先预留日志额度，额度不足时返回-NEWFS_ERROR_AGAIN，提交之后在这里重试。
+*******************************************************************************/
+static int newfs_mkdir_locked(const char* path, mode_t mode) {
+	int ret;
+	do {
+		newfs_ns_rdlock();
+		ret = newfs_mkdir(path, mode);
+		newfs_ns_unlock();
+	} while (newfs_flush_retry(&ret));
+	return ret;
+}
+
+static int newfs_getattr_locked(const char* path, struct stat* newfs_stat) {
+	int ret;
+	newfs_ns_rdlock();
+	ret = newfs_getattr(path, newfs_stat);
+	newfs_ns_unlock();
+	return ret;
+}
+
+static int newfs_readdir_locked(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
+								struct fuse_file_info* fi) {
+	int ret;
+	newfs_ns_rdlock();
+	ret = newfs_readdir(path, buf, filler, offset, fi);
+	newfs_ns_unlock();
+	return ret;
+}
+
+static int newfs_mknod_locked(const char* path, mode_t mode, dev_t dev) {
+	int ret;
+	do {
+		newfs_ns_rdlock();
+		ret = newfs_mknod(path, mode, dev);
+		newfs_ns_unlock();
+	} while (newfs_flush_retry(&ret));
+	return ret;
+}
+
+static int newfs_symlink_locked(const char* target, const char* path) {
+	int ret;
+	do {
+		newfs_ns_rdlock();
+		ret = newfs_symlink(target, path);
+		newfs_ns_unlock();
+	} while (newfs_flush_retry(&ret));
+	return ret;
+}
+
+static int newfs_readlink_locked(const char* path, char* buf, size_t size) {
+	int ret;
+	newfs_ns_rdlock();
+	ret = newfs_readlink(path, buf, size);
+	newfs_ns_unlock();
+	return ret;
+}
+
+static int newfs_write_locked(const char* path, const char* buf, size_t size, off_t offset,
+							  struct fuse_file_info* fi) {
+	int ret;
+	do {
+		newfs_ns_rdlock();
+		ret = newfs_write(path, buf, size, offset, fi);
+		newfs_flusher_kick();						  /* 脏数据过多时提前回写 */
+		newfs_ns_unlock();
+	} while (newfs_flush_retry(&ret));
+	return ret;
+}
+
+static int newfs_read_locked(const char* path, char* buf, size_t size, off_t offset,
+							 struct fuse_file_info* fi) {
+	int ret;
+	newfs_ns_rdlock();
+	ret = newfs_read(path, buf, size, offset, fi);
+	newfs_ns_unlock();
+	return ret;
+}
+
+static int newfs_unlink_locked(const char* path) {
+	int ret;
+	do {
+		newfs_ns_wrlock();
+		ret = newfs_unlink(path);
+		newfs_ns_unlock();
+	} while (newfs_flush_retry(&ret));
+	return ret;
+}
+
+static int newfs_rmdir_locked(const char* path) {
+	int ret;
+	do {
+		newfs_ns_wrlock();
+		ret = newfs_rmdir(path);
+		newfs_ns_unlock();
+	} while (newfs_flush_retry(&ret));
+	return ret;
+}
+
+static int newfs_rename_locked(const char* from, const char* to) {
+	int ret;
+	do {
+		newfs_ns_wrlock();
+		ret = newfs_rename(from, to);
+		newfs_ns_unlock();
+	} while (newfs_flush_retry(&ret));
+	return ret;
+}
+
+static int newfs_open_locked(const char* path, struct fuse_file_info* fi) {
+	int ret;
+	newfs_ns_rdlock();
+	ret = newfs_open(path, fi);
+	newfs_ns_unlock();
+	return ret;
+}
+
+static int newfs_opendir_locked(const char* path, struct fuse_file_info* fi) {
+	int ret;
+	newfs_ns_rdlock();
+	ret = newfs_opendir(path, fi);
+	newfs_ns_unlock();
+	return ret;
+}
+
+static int newfs_releasedir_locked(const char* path, struct fuse_file_info* fi) {
+	int ret;
+	newfs_ns_rdlock();
+	ret = newfs_releasedir(path, fi);
+	newfs_ns_unlock();
+	return ret;
+}
+
+static int newfs_access_locked(const char* path, int type) {
+	int ret;
+	newfs_ns_rdlock();
+	ret = newfs_access(path, type);
+	newfs_ns_unlock();
+	return ret;
+}
+
+static int newfs_flush_locked(const char* path, struct fuse_file_info* fi) {
+	int ret;
+	newfs_ns_rdlock();
+	ret = newfs_flush(path, fi);
+	newfs_ns_unlock();
+	return ret;
+}
+
+static int newfs_fsync_locked(const char* path, int datasync, struct fuse_file_info* fi) {
+	int ret;
+	newfs_ns_rdlock();
+	ret = newfs_fsync(path, datasync, fi);			  /* 文件数据在共享锁下写出 */
+	newfs_ns_unlock();
+	if (ret == NEWFS_ERROR_NONE) {
+		ret = newfs_flush_commit();
+	}
+	return ret;
+}
+
+static int newfs_fsyncdir_locked(const char* path, int datasync, struct fuse_file_info* fi) {
+	int ret;
+	newfs_ns_rdlock();
+	ret = newfs_fsyncdir(path, datasync, fi);
+	newfs_ns_unlock();
+	if (ret == NEWFS_ERROR_NONE) {
+		ret = newfs_flush_commit();
+	}
+	return ret;
+}
+
 /******************************************************************************
 * SECTION: FUSE操作定义
 *******************************************************************************/
 static struct fuse_operations operations = {
 	.init = newfs_init,						 /* mount文件系统 */		
 	.destroy = newfs_destroy,				 /* umount文件系统 */
-	.mkdir = newfs_mkdir,					 /* 建目录，mkdir */
-	.getattr = newfs_getattr,				 /* 获取文件属性，类似stat，必须完成 */
-	.readdir = newfs_readdir,				 /* 填充dentrys */
-	.mknod = newfs_mknod,					 /* 创建文件，touch相关 */
-	.write = newfs_write,								  	 /* 写入文件 */
-	.read = newfs_read,								  	 /* 读文件 */
+	.mkdir = newfs_mkdir_locked,			 /* 建目录，mkdir */
+	.getattr = newfs_getattr_locked,		 /* 获取文件属性，类似stat，必须完成 */
+	.readdir = newfs_readdir_locked,		 /* 填充dentrys */
+	.mknod = newfs_mknod_locked,			 /* 创建文件，touch相关 */
+	.symlink = newfs_symlink_locked,		 /* 创建符号链接，ln -s */
+	.readlink = newfs_readlink_locked,		 /* 读符号链接的目标 */
+	.write = newfs_write_locked,						  	 /* 写入文件 */
+	.read = newfs_read_locked,						  	 /* 读文件 */
 	.utimens = newfs_utimens,				 /* 修改时间，忽略，避免touch报错 */
 	.truncate = newfs_access,						  		 /* 改变文件大小 */
-	.unlink = newfs_unlink,							  		 /* 删除文件 */
-	.rmdir	= NULL,							  		 /* 删除目录， rm -r */
-	.rename = newfs_rename,							  		 /* 重命名，mv */
+	.unlink = newfs_unlink_locked,					  		 /* 删除文件 */
+	.rmdir	= newfs_rmdir_locked,				  		 /* 删除目录， rm -r */
+	.rename = newfs_rename_locked,					  		 /* 重命名，mv */
+	.flush = newfs_flush_locked,					  		 /* close时唤醒回写线程 */
+	.fsync = newfs_fsync_locked,					  		 /* 文件落盘 */
+	.fsyncdir = newfs_fsyncdir_locked,				  		 /* 目录落盘 */
 
-	.open = newfs_open,							
-	.opendir = newfs_opendir,
-	.access = newfs_access
+	.open = newfs_open_locked,							
+	.opendir = newfs_opendir_locked,
+	.releasedir = newfs_releasedir_locked,
+	.access = newfs_access_locked
 };
 
 
@@ -57,6 +244,9 @@ void* newfs_init(struct fuse_conn_info * conn_info) {
 		fuse_exit(fuse_get_context()->fuse);
 		return NULL;
 	} 
+	if (newfs_flusher_start() != NEWFS_ERROR_NONE) {  /* 挂载成功后启动后台回写 */
+		NEWFS_DBG("[%s] start flusher error\n", __func__);
+	}
 	return NULL;
 }
 
@@ -68,6 +258,7 @@ void* newfs_init(struct fuse_conn_info * conn_info) {
  */
 void newfs_destroy(void* p) {
 	/* TODO: 在这里进行卸载 */
+	newfs_flusher_stop();							  /* 先停回写线程，再做最后一次同步 */
 	if (newfs_umount() != NEWFS_ERROR_NONE) {
 		NEWFS_DBG("[%s] unmount error\n", __func__);
 		fuse_exit(fuse_get_context()->fuse);
@@ -76,6 +267,28 @@ void newfs_destroy(void* p) {
 	return;
 }
 
+/* 在目录下新建一项，下一次写回最多改动的元数据块：末尾的两个目录项块、目录增长一块时的
+ * 块映射，新inode的inode表块与inode位图块，以及长符号链接的数据块与其数据位图块 */
+static int newfs_create_credits(struct newfs_inode* dir) {
+	return 2 + newfs_bmap_credits(NULL, dir->allocated_nums, dir->allocated_nums + 1) + 2 + 2;
+}
+
+/* 从目录中删除inode：其后的目录项整体前移，目录的全部目录项块与inode表块，
+ * 以及inode位图块与释放的数据块所在的位图块；inode为NULL时不释放数据块 */
+static int newfs_remove_credits(struct newfs_inode* dir, struct newfs_inode* inode) {
+	return dir->allocated_nums + 1 + 1 +
+		   (inode != NULL ? newfs_bmap_credits(inode, inode->allocated_nums, 0) : 0);
+}
+
+/* 新建失败时放弃刚分配的inode：归还它的块与inode号，释放内存中的inode与dentry */
+static void newfs_abandon_inode(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+	newfs_bmap_truncate(inode, 0);
+	newfs_bitmap_free(newfs_super.ino_map, inode->ino);
+	newfs_map_dirty(newfs_super.ino_map_dirty, inode->ino, 1);
+	newfs_free_inode(inode);
+	free(dentry);
+}
+
 /**
  * @brief 创建目录
  * 
@@ -90,6 +303,10 @@ int newfs_mkdir(const char* path, mode_t mode) {
 	char* fname;
 	struct newfs_dentry* dentry;
 	struct newfs_inode*  inode;
+	int ret;
+	if (last_dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	if(is_find){
 		return -NEWFS_ERROR_EXISTS; 
 	}
@@ -97,16 +314,40 @@ int newfs_mkdir(const char* path, mode_t mode) {
 		return -NEWFS_ERROR_UNSUPPORTED;
 	}
 	fname = newfs_get_fname(path);
+	if (strlen(fname) >= MAX_NAME_LEN) {				/* 目录项记录与内存中的名字都容纳不下 */
+		return -NEWFS_ERROR_NAMETOOLONG;
+	}
+	newfs_inode_wrlock(last_dentry->inode);
+	if (newfs_dindex_find(last_dentry->inode, fname) != NULL) {	/* 查找之后被其他线程抢先创建 */
+		newfs_inode_unlock(last_dentry->inode);
+		return -NEWFS_ERROR_EXISTS;
+	}
+	ret = newfs_journal_reserve(newfs_create_credits(last_dentry->inode));
+	if (ret != NEWFS_ERROR_NONE) {
+		newfs_inode_unlock(last_dentry->inode);
+		return ret;
+	}
 	dentry = new_dentry(fname, NEWFS_DIR);
 	dentry->parent = last_dentry;
 	inode = newfs_alloc_inode(dentry); //为该目录项分配一个索引来存储该目录项的所有子目录项
-	newfs_alloc_dentry(last_dentry->inode, dentry, TRUE); ////写的时候需要考虑是否新分配一个逻辑块
+	if (inode == NULL) {
+		free(dentry);
+		newfs_inode_unlock(last_dentry->inode);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	if (newfs_alloc_dentry(last_dentry->inode, dentry, TRUE) < 0) { ////写的时候需要考虑是否新分配一个逻辑块
+		newfs_abandon_inode(inode, dentry);
+		newfs_inode_unlock(last_dentry->inode);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	newfs_dcache_invalidate_neg();     /* 该路径不再是负项 */
 	printf("Mkdir:\n");
 	printf("Father ino: %d\n", last_dentry->ino);
 	printf("	child ino: %d\n", last_dentry->inode->dentrys->ino);
 	printf("	child fype: %d\n", dentry->ftype);
 	printf("	inode:ino:%d\n", inode->ino);
 	printf("	inode if is dir%d\n", NEWFS_IS_DIR(inode));
+	newfs_inode_unlock(last_dentry->inode);
 	return NEWFS_ERROR_NONE;
 }
 
@@ -121,13 +362,17 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
 	/* TODO: 解析路径，获取Inode，填充newfs_stat，可参考/fs/simplefs/newfs.c的newfs_getattr()函数实现 */
 	boolean	is_find, is_root;
 	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	if (is_find == FALSE) {
 		return -NEWFS_ERROR_NOTFOUND;
 	}
 
+	newfs_inode_rdlock(dentry->inode);
 	if (NEWFS_IS_DIR(dentry->inode)) {
 		newfs_stat->st_mode = S_IFDIR | NEWFS_DEFAULT_PERM;
-		newfs_stat->st_size = dentry->inode->dir_cnt * sizeof(struct newfs_dentry_d);
+		newfs_stat->st_size = NEWFS_BLKS_SZ(dentry->inode->allocated_nums);
 	}
 	else if (NEWFS_IS_REG(dentry->inode)) {
 		newfs_stat->st_mode = S_IFREG | NEWFS_DEFAULT_PERM;
@@ -137,6 +382,7 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
 		newfs_stat->st_mode = S_IFLNK | NEWFS_DEFAULT_PERM;
 		newfs_stat->st_size = dentry->inode->size;
 	}
+	newfs_inode_unlock(dentry->inode);
 
 	newfs_stat->st_nlink = 1;
 	newfs_stat->st_uid 	 = getuid();
@@ -168,22 +414,58 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
  * off: 下一次offset从哪里开始，这里可以理解为第几个dentry
  * 
  * @param offset 第几个目录项？
- * @param fi 可忽略
+ * @param fi opendir时保存的目录游标，从游标处继续，一次填满filler的缓冲
  * @return int 0成功，否则返回对应错误号
  */
 int newfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t offset,
 			    		 struct fuse_file_info * fi) {
-    /* TODO: 解析路径，获取目录的Inode，并读取目录项，利用filler填充到buf，可参考/fs/simplefs/newfs.c的newfs_readdir()函数实现 */
-    boolean is_find, is_root;
-	struct newfs_dentry * dentry = newfs_lookup(path, &is_find, &is_root);
-	if(is_find){
-		struct newfs_dentry* sub_dentry = newfs_get_dentry(dentry->inode, offset);
-		if (sub_dentry) {
-            /* 直接调用filler来装填结果 */
-            filler(buf, sub_dentry->fname, NULL, ++offset);
-        }
+	struct newfs_dir_cursor* cursor = (struct newfs_dir_cursor*)(uintptr_t)fi->fh;
+	struct newfs_dentry* sub_dentry;
+	struct newfs_inode*  dir_inode;
+	struct stat          sub_stat;
+	boolean is_find, is_root;
+
+	if (cursor == NULL) {							  /* 没有经过opendir，临时建立游标 */
+		struct newfs_dentry * dentry = newfs_lookup(path, &is_find, &is_root);
+		if (dentry == NULL) {
+			return -NEWFS_ERROR_IO;
+		}
+		if (!is_find) {
+			return -NEWFS_ERROR_NOTFOUND;
+		}
+		dir_inode  = dentry->inode;
+		newfs_inode_rdlock(dir_inode);
+		sub_dentry = newfs_get_dentry(dir_inode, offset);
 	}
-	return 0;
+	else {
+		dir_inode = cursor->dir;
+		newfs_inode_rdlock(dir_inode);
+		/* 游标与offset不一致（seekdir/rewinddir）或目录项被删除过，重新定位 */
+		if (cursor->offset != offset || cursor->dir_ver != dir_inode->dir_ver) {
+			cursor->next    = newfs_get_dentry(dir_inode, offset);
+			cursor->offset  = offset;
+			cursor->dir_ver = dir_inode->dir_ver;
+		}
+		sub_dentry = cursor->next;
+	}
+
+	memset(&sub_stat, 0, sizeof(struct stat));
+	while (sub_dentry) {
+		sub_stat.st_ino  = sub_dentry->ino;
+		sub_stat.st_mode = (sub_dentry->ftype == NEWFS_DIR ? S_IFDIR :
+						    sub_dentry->ftype == NEWFS_SYM_LINK ? S_IFLNK : S_IFREG) | NEWFS_DEFAULT_PERM;
+		if (filler(buf, sub_dentry->fname, &sub_stat, offset + 1) != 0) {
+			break;									  /* 缓冲已满，下次从这里继续 */
+		}
+		offset++;
+		sub_dentry = sub_dentry->brother;
+	}
+	if (cursor) {
+		cursor->next   = sub_dentry;
+		cursor->offset = offset;
+	}
+	newfs_inode_unlock(dir_inode);
+	return NEWFS_ERROR_NONE;
 }
 
 /**
@@ -201,12 +483,29 @@ int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
 	struct newfs_dentry* dentry;
 	struct newfs_inode* inode;
 	char* fname;
+	int ret;
 	
+	if (last_dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	if (is_find == TRUE) {
 		return -NEWFS_ERROR_EXISTS;
 	}
 
 	fname = newfs_get_fname(path);
+	if (strlen(fname) >= MAX_NAME_LEN) {
+		return -NEWFS_ERROR_NAMETOOLONG;
+	}
+	newfs_inode_wrlock(last_dentry->inode);
+	if (newfs_dindex_find(last_dentry->inode, fname) != NULL) {	/* 查找之后被其他线程抢先创建 */
+		newfs_inode_unlock(last_dentry->inode);
+		return -NEWFS_ERROR_EXISTS;
+	}
+	ret = newfs_journal_reserve(newfs_create_credits(last_dentry->inode));
+	if (ret != NEWFS_ERROR_NONE) {
+		newfs_inode_unlock(last_dentry->inode);
+		return ret;
+	}
 	if (S_ISREG(mode)) {
 		dentry = new_dentry(fname, NEWFS_REG_FILE);
 	}
@@ -218,14 +517,126 @@ int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
 	}
 	dentry->parent = last_dentry;
 	inode = newfs_alloc_inode(dentry);
-	newfs_alloc_dentry(last_dentry->inode, dentry, TRUE); //写的时候需要考虑是否新分配一个逻辑块
+	if (inode == NULL) {
+		free(dentry);
+		newfs_inode_unlock(last_dentry->inode);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	if (newfs_alloc_dentry(last_dentry->inode, dentry, TRUE) < 0) { //写的时候需要考虑是否新分配一个逻辑块
+		newfs_abandon_inode(inode, dentry);
+		newfs_inode_unlock(last_dentry->inode);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	newfs_dcache_invalidate_neg();     /* 该路径不再是负项 */
 	printf("Touch:\n");
 	printf("Father ino: %d\n", last_dentry->ino);
 	printf("	child ino: %d\n", last_dentry->inode->dentrys->ino);
 	printf("	child fype: %d\n", dentry->ftype);
 	printf("	inode:ino:%d\n", inode->ino);
 	printf("	inode if is REG%d\n", NEWFS_IS_REG(inode));
+	newfs_inode_unlock(last_dentry->inode);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 创建符号链接，目标不超过NEWFS_SYMLINK_INLINE_MAX字节时存放在inode记录中，
+ * 否则占用一个数据块
+ * 
+ * @param target 链接的目标路径，不做解析
+ * @param path 相对于挂载点的路径
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_symlink(const char* target, const char* path) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* last_dentry;
+	struct newfs_dentry* dentry;
+	struct newfs_inode* inode;
+	char* fname;
+	int len = (int)strlen(target);
+	int ret;
+
+	if (len >= NEWFS_MAX_FILE_NAME) {
+		return -NEWFS_ERROR_NAMETOOLONG;
+	}
+	last_dentry = newfs_lookup(path, &is_find, &is_root);
+	if (last_dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == TRUE) {
+		return -NEWFS_ERROR_EXISTS;
+	}
+	if (!NEWFS_IS_DIR(last_dentry->inode)) {
+		return -NEWFS_ERROR_UNSUPPORTED;
+	}
+
+	fname = newfs_get_fname(path);
+	if (strlen(fname) >= MAX_NAME_LEN) {
+		return -NEWFS_ERROR_NAMETOOLONG;
+	}
+	newfs_inode_wrlock(last_dentry->inode);
+	if (newfs_dindex_find(last_dentry->inode, fname) != NULL) {	/* 查找之后被其他线程抢先创建 */
+		newfs_inode_unlock(last_dentry->inode);
+		return -NEWFS_ERROR_EXISTS;
+	}
+	ret = newfs_journal_reserve(newfs_create_credits(last_dentry->inode));
+	if (ret != NEWFS_ERROR_NONE) {
+		newfs_inode_unlock(last_dentry->inode);
+		return ret;
+	}
+	dentry = new_dentry(fname, NEWFS_SYM_LINK);
+	dentry->parent = last_dentry;
+	inode = newfs_alloc_inode(dentry);
+	if (inode == NULL) {
+		free(dentry);
+		newfs_inode_unlock(last_dentry->inode);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	inode->size = len;
+	memcpy(inode->target_path, target, len + 1);
+	if ((len > NEWFS_SYMLINK_INLINE_MAX && newfs_bmap_grow(inode, 1) != NEWFS_ERROR_NONE) ||
+		newfs_alloc_dentry(last_dentry->inode, dentry, TRUE) < 0) {
+		newfs_abandon_inode(inode, dentry);
+		newfs_inode_unlock(last_dentry->inode);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	newfs_dcache_invalidate_neg();     /* 该路径不再是负项 */
+	newfs_inode_unlock(last_dentry->inode);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 读符号链接的目标
+ * 
+ * @param path 相对于挂载点的路径
+ * @param buf 目标路径，以'\0'结尾，过长时截断
+ * @param size buf的大小
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_readlink(const char* path, char* buf, size_t size) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_inode*  inode;
+	size_t len;
+
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	inode = dentry->inode;
+	if (!NEWFS_IS_SYM_LINK(inode)) {
+		return -NEWFS_ERROR_INVAL;
+	}
+	if (size == 0) {
+		return NEWFS_ERROR_NONE;
+	}
 
+	newfs_inode_rdlock(inode);
+	len = (size_t)inode->size < size - 1 ? (size_t)inode->size : size - 1;
+	memcpy(buf, inode->target_path, len);
+	buf[len] = '\0';
+	newfs_inode_unlock(inode);
 	return NEWFS_ERROR_NONE;
 }
 
@@ -243,6 +654,48 @@ int newfs_utimens(const char* path, const struct timespec tv[2]) {
 /******************************************************************************
 * SECTION: 选做函数实现
 *******************************************************************************/
+/* 持有inode写锁时写入文件内容 */
+static int newfs_do_write(struct newfs_inode* inode, const char* buf, size_t size, off_t offset) {
+	int old_nums = inode->allocated_nums;
+	int need_blks, ret;
+
+	if (inode->size < offset) {
+		return -NEWFS_ERROR_SEEK;
+	}
+	if (offset + (int64_t)size > NEWFS_BLKS_SZ((int64_t)NEWFS_MAX_FILE_BLKS)) {
+		return -NEWFS_ERROR_FBIG;
+	}
+	/* 一次分配写入所需的全部数据块（含间接块），按实际分配到的块预留日志额度 */
+	need_blks = NEWFS_ROUND_UP(offset + size, NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
+	if (need_blks > old_nums && newfs_bmap_grow(inode, need_blks - old_nums) != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	ret = newfs_journal_reserve(newfs_bmap_credits(inode, old_nums, inode->allocated_nums));
+	/* 新增的块多到一个事务记录不下时，只写到下一个块为止，返回实际写入的字节数 */
+	if (ret == -NEWFS_ERROR_NOSPACE && need_blks > old_nums + 1) {
+		newfs_bmap_truncate(inode, old_nums + 1);
+		need_blks = old_nums + 1;
+		size      = NEWFS_BLKS_SZ((int64_t)need_blks) - offset;
+		ret       = newfs_journal_reserve(newfs_bmap_credits(inode, old_nums, need_blks));
+	}
+	if (ret != NEWFS_ERROR_NONE) {					  /* 退回刚分配的块，磁盘上的内容没有变化 */
+		newfs_bmap_truncate(inode, old_nums);
+		return ret;
+	}
+	if (need_blks > old_nums && newfs_data_resize(inode, old_nums) != NEWFS_ERROR_NONE) {	/* 扩大内存中的文件内容 */
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	/* 只读入被部分覆盖且尚未驻留的首尾块 */
+	if (newfs_data_fault(inode, offset, size, TRUE) != NEWFS_ERROR_NONE)
+		return -NEWFS_ERROR_IO;
+	memcpy(inode->data + offset, buf, size);
+	if (offset + size > inode->size) {
+		inode->size = offset + size;
+		inode->flag |= NEWFS_FLAG_INODE_DIRTY;
+	}
+	return size;
+}
+
 /**
  * @brief 写入文件
  * 
@@ -259,7 +712,11 @@ int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
 	 boolean	is_find, is_root;
 	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
 	struct newfs_inode*  inode;
+	int ret;
 	
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	if (is_find == FALSE) {
 		return -NEWFS_ERROR_NOTFOUND;
 	}
@@ -270,38 +727,10 @@ int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		return -NEWFS_ERROR_ISDIR;	
 	}
 
-	if (inode->size < offset) {
-		return -NEWFS_ERROR_SEEK;
-	}
-	if(offset + size > NEWFS_BLKS_SZ(inode->allocated_nums)){
-		int byte_cursor = 0; 
-		int bit_cursor  = 0; 
-		int data_cursor  = 0;
-		boolean is_find_free_entry = FALSE;
-		for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.data_map_blks); //字节位
-			byte_cursor++)
-		{
-			for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {          //比特位
-				if((newfs_super.data_map[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-														/* 当前data_cursor位置空闲 */
-					newfs_super.data_map[byte_cursor] |= (0x1 << bit_cursor);
-					is_find_free_entry = TRUE;           
-					break;
-				}
-				data_cursor++;
-			}
-			if (is_find_free_entry) {
-				break;
-			}
-		}
-		if (!is_find_free_entry || data_cursor == newfs_super.ino_max)
-			return -NEWFS_ERROR_NOSPACE;
-		inode->blk_pointers[inode->allocated_nums] = data_cursor;
-		inode->allocated_nums += 1;
-	}
-	memcpy(inode->data + offset, buf, size);
-	inode->size = offset + size > inode->size ? offset + size : inode->size;
-	return size;
+	newfs_inode_wrlock(inode);
+	ret = newfs_do_write(inode, buf, size, offset);
+	newfs_inode_unlock(inode);
+	return ret;
 }
 
 /**
@@ -321,6 +750,9 @@ int newfs_read(const char* path, char* buf, size_t size, off_t offset,
 	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
 	struct newfs_inode*  inode;
 
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	if (is_find == FALSE) {
 		return -NEWFS_ERROR_NOTFOUND;
 	}
@@ -331,10 +763,20 @@ int newfs_read(const char* path, char* buf, size_t size, off_t offset,
 		return -NEWFS_ERROR_ISDIR;	
 	}
 
+	newfs_inode_rdlock(inode);
 	if (inode->size < offset) {
+		newfs_inode_unlock(inode);
 		return -NEWFS_ERROR_SEEK;
 	}
+	if (offset + size > inode->size) {				  /* 读到文件末尾为止 */
+		size = inode->size - offset;
+	}
+	if (newfs_data_fault(inode, offset, size, FALSE) != NEWFS_ERROR_NONE) { /* 按需读入 */
+		newfs_inode_unlock(inode);
+		return -NEWFS_ERROR_IO;
+	}
 	memcpy(buf, inode->data + offset, size);
+	newfs_inode_unlock(inode);
 	return size;			   
 }
 
@@ -348,13 +790,22 @@ int newfs_unlink(const char* path) {
 	boolean	is_find, is_root;
 	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
 	struct newfs_inode*  inode;
+	int ret;
 
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	if (is_find == FALSE) {
 		return -NEWFS_ERROR_NOTFOUND;
 	}
 
 	inode = dentry->inode;
+	ret = newfs_journal_reserve(newfs_remove_credits(dentry->parent->inode, inode));
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
 
+	newfs_dcache_invalidate(path);
 	newfs_drop_inode(inode);
 	newfs_drop_dentry(dentry->parent->inode, dentry);
 	return NEWFS_ERROR_NONE;
@@ -367,14 +818,40 @@ int newfs_unlink(const char* path) {
  * rm ./tests/mnt/j/ -r
  *  1) Step 1. rm ./tests/mnt/j/j
  *  2) Step 2. rm ./tests/mnt/j
- * 即，先删除最深层的文件，再删除目录文件本身
+ * 即，先删除最深层的文件，再删除目录文件本身；目录非空时返回-ENOTEMPTY
  * 
  * @param path 相对于挂载点的路径
  * @return int 0成功，否则返回对应错误号
  */
 int newfs_rmdir(const char* path) {
-	/* 选做 */
-	return 0;
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	int ret;
+
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (is_root) {
+		return -NEWFS_ERROR_INVAL;
+	}
+	if (!NEWFS_IS_DIR(dentry->inode)) {
+		return -NEWFS_ERROR_NOTDIR;
+	}
+	if (dentry->inode->dir_cnt > 0) {        /* 只删除空目录，rm -r会先删除目录下的文件 */
+		return -NEWFS_ERROR_NOTEMPTY;
+	}
+	ret = newfs_journal_reserve(newfs_remove_credits(dentry->parent->inode, dentry->inode));
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+
+	newfs_dcache_invalidate(path);
+	newfs_drop_inode(dentry->inode);
+	newfs_drop_dentry(dentry->parent->inode, dentry);
+	return NEWFS_ERROR_NONE;
 }
 
 /**
@@ -390,7 +867,11 @@ int newfs_rename(const char* from, const char* to) {
 	struct newfs_dentry* from_dentry = newfs_lookup(from, &is_find, &is_root); //先找到原目录
 	struct newfs_inode*  from_inode;
 	struct newfs_dentry* to_dentry;
+	struct newfs_dentry* sub_dentry;
 	mode_t mode = 0;
+	if (from_dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	if (is_find == FALSE) {
 		return -NEWFS_ERROR_NOTFOUND;
 	}
@@ -400,6 +881,10 @@ int newfs_rename(const char* from, const char* to) {
 	}
 
 	from_inode = from_dentry->inode;
+	ret = newfs_journal_reserve(newfs_remove_credits(from_dentry->parent->inode, NULL)); /* mknod另行预留 */
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
 	
 	if (NEWFS_IS_DIR(from_inode)) {
 		mode = S_IFDIR;
@@ -414,11 +899,23 @@ int newfs_rename(const char* from, const char* to) {
 	}
 	
 	to_dentry = newfs_lookup(to, &is_find, &is_root);	  
+	if (to_dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	newfs_drop_inode(to_dentry->inode);				  /* 保证生成的inode被释放 */	
 	to_dentry->ino = from_inode->ino;				  /* 指向新的inode */
+	to_dentry->ftype = from_dentry->ftype;				  /* 符号链接经mknod建成了普通文件 */
 	to_dentry->inode = from_inode;
+	from_inode->dentry = to_dentry;
+	if (NEWFS_IS_DIR(from_inode)) {					  /* 移动目录时子项改为挂在to_dentry下 */
+		for (sub_dentry = from_inode->dentrys; sub_dentry != NULL; sub_dentry = sub_dentry->brother) {
+			sub_dentry->parent = to_dentry;
+		}
+	}
 	
+	newfs_dcache_invalidate(from);					  /* 缓存中指向from_dentry的项都以from为前缀 */
 	newfs_drop_dentry(from_dentry->parent->inode, from_dentry);
+	free(from_dentry);								  /* dir_ver已变，游标不会再用到它 */
 	return ret;
 }
 
@@ -443,7 +940,121 @@ int newfs_open(const char* path, struct fuse_file_info* fi) {
  * @return int 0成功，否则返回对应错误号
  */
 int newfs_opendir(const char* path, struct fuse_file_info* fi) {
-	/* 选做 */
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_dir_cursor* cursor;
+
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (!NEWFS_IS_DIR(dentry->inode)) {
+		return -NEWFS_ERROR_NOTDIR;
+	}
+	cursor = (struct newfs_dir_cursor*)malloc(sizeof(struct newfs_dir_cursor));
+	newfs_get_dir(dentry->inode);					  /* 目录被rmdir或rename后游标仍可安全使用 */
+	newfs_inode_rdlock(dentry->inode);
+	cursor->dir     = dentry->inode;
+	cursor->next    = dentry->inode->dentrys;
+	cursor->offset  = 0;
+	cursor->dir_ver = dentry->inode->dir_ver;
+	newfs_inode_unlock(dentry->inode);
+	fi->fh = (uint64_t)(uintptr_t)cursor;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 关闭目录文件，释放opendir建立的游标并解除对目录inode的固定
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_releasedir(const char* path, struct fuse_file_info* fi) {
+	struct newfs_dir_cursor* cursor = (struct newfs_dir_cursor*)(uintptr_t)fi->fh;
+
+	if (cursor) {
+		newfs_put_dir(cursor->dir);
+		free(cursor);
+	}
+	fi->fh = 0;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 关闭文件时调用。close不要求落盘，这里不写回，只在脏数据超过阈值时唤醒回写线程，
+ * 需要持久化时由fsync完成
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_flush(const char* path, struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+
+	if (newfs_lookup(path, &is_find, &is_root) == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	newfs_flusher_kick();
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 文件落盘的数据部分：在共享名字空间锁与该文件的inode写锁下把文件数据写到设备，
+ * 其他文件的操作照常进行。元数据由加锁入口随后独占名字空间锁提交（newfs_flush_commit），
+ * 位图中的位总是与改动它的inode在同一个事务中
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 非0时只要求数据落盘，newfs中分配信息也属于数据，处理相同
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	int ret;
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (NEWFS_IS_DIR(dentry->inode)) {				  /* 目录要连同子项写回，由fsyncdir完成 */
+		return -NEWFS_ERROR_ISDIR;
+	}
+	if (!NEWFS_IS_REG(dentry->inode)) {				  /* 符号链接没有缓存的数据 */
+		return NEWFS_ERROR_NONE;
+	}
+	newfs_inode_wrlock(dentry->inode);
+	ret = newfs_sync_data(dentry->inode);
+	newfs_inode_unlock(dentry->inode);
+	return ret;
+}
+
+/**
+ * @brief 目录落盘，只检查目录存在，目录项与子项随加锁入口中的newfs_flush_commit一并写回
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 同newfs_fsync
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_fsyncdir(const char* path, int datasync, struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
 	return NEWFS_ERROR_NONE;
 }
 
@@ -460,6 +1071,9 @@ int newfs_truncate(const char* path, off_t offset) {
 	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
 	struct newfs_inode*  inode;
 	
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	if (is_find == FALSE) {
 		return -NEWFS_ERROR_NOTFOUND;
 	}
@@ -471,6 +1085,7 @@ int newfs_truncate(const char* path, off_t offset) {
 	}
 
 	inode->size = offset;
+	inode->flag |= NEWFS_FLAG_INODE_DIRTY;
 
 	return NEWFS_ERROR_NONE;
 }
@@ -495,6 +1110,10 @@ int newfs_access(const char* path, int type) {
 	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
 	struct newfs_inode*  inode;
 
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+
 	switch (type)
 	{
 	case R_OK:
@@ -525,6 +1144,10 @@ int main(int argc, char **argv)
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
 	newfs_options.device = strdup("/dev/ddriver");
+	newfs_options.cache_blks = NEWFS_DEFAULT_CACHE_BLKS;
+	newfs_options.flush_interval = NEWFS_DEFAULT_FLUSH_INTERVAL;
+	newfs_options.flush_dirty_kb = NEWFS_DEFAULT_FLUSH_DIRTY_KB;
+	newfs_options.inode_ratio = NEWFS_DEFAULT_INODE_RATIO;
 
 	if (fuse_opt_parse(&args, &newfs_options, option_spec, NULL) == -1)
 		return -1;
@@ -0,0 +1,362 @@
+#include "../include/newfs.h"
+/* 向量读取对ThreadSanitizer不可见为原子读，TSan构建只用标量版本 */
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(__SANITIZE_THREAD__)
+#include <immintrin.h>
+#define NEWFS_HAVE_AVX2_PATH
+#endif
+
+/******************************************************************************
+* SECTION: 位图分配器
+* 位图按字节低位在前存放（第i位位于第i/8字节的第i%8位），在小端机器上与按64位字
+* 读取时的第i/64个字的第i%64位一致，因此可以一次检查64位。
+*
+* 分配与释放不加锁：查找只是读取（可能读到旧值），真正占用时对64位字做CAS，
+* 要占用的位中任何一位已被其他线程抢先占用就放弃，撤销已占用的部分后重新查找；
+* 释放用原子与。每个线程有自己的分配起点，按线程序号错开，并发分配很少落在同一个字上。
+*******************************************************************************/
+typedef uint64_t __attribute__((__may_alias__)) newfs_word_t;
+
+#define NEWFS_WORD_BITS           64
+#define NEWFS_WORD_FULL           (~(uint64_t)0)
+#define NEWFS_WORD_LOAD(pword)    __atomic_load_n((pword), __ATOMIC_RELAXED)
+#define NEWFS_HINT_SPREAD         16      /* 线程起点把位图分成的份数 */
+
+static __thread int newfs_thread_hints[NEWFS_HINT_CNT] = { -1, -1 };
+static __thread int newfs_thread_seq = -1;
+static int          newfs_thread_cnt = 0;
+
+/**
+ * @brief 标量版本：从第from个字开始，找到第一个不全为1的字
+ *
+ * @return int 字下标，找不到返回to
+ */
+static int newfs_bitmap_skip_full_scalar(const newfs_word_t* words, int from, int to) {
+    while (from < to && NEWFS_WORD_LOAD(words + from) == NEWFS_WORD_FULL) {
+        from++;
+    }
+    return from;
+}
+
+#ifdef NEWFS_HAVE_AVX2_PATH
+/**
+ * @brief AVX2版本：一次检查256位，读到的旧值只影响查找起点，占用时仍以CAS为准
+ */
+__attribute__((target("avx2")))
+static int newfs_bitmap_skip_full_avx2(const newfs_word_t* words, int from, int to) {
+    __m256i ones = _mm256_set1_epi64x(-1);
+    while (from + 4 <= to) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(words + from));
+        if (!_mm256_testc_si256(v, ones)) {         /* 这256位中存在0 */
+            break;
+        }
+        from += 4;
+    }
+    return newfs_bitmap_skip_full_scalar(words, from, to);
+}
+#endif
+
+static int (*newfs_bitmap_skip_full)(const newfs_word_t*, int, int) = NULL;
+
+static void newfs_bitmap_select_impl() {
+    newfs_bitmap_skip_full = newfs_bitmap_skip_full_scalar;
+#ifdef NEWFS_HAVE_AVX2_PATH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        newfs_bitmap_skip_full = newfs_bitmap_skip_full_avx2;
+    }
+#endif
+}
+
+/**
+ * @brief 找到[from, nbits)中第一个为0的位
+ *
+ * @return int 位下标，找不到返回nbits
+ */
+static int newfs_bitmap_next_zero(uint8_t* map, int nbits, int from) {
+    const newfs_word_t* words = (const newfs_word_t*)map;
+    int nwords = (nbits + NEWFS_WORD_BITS - 1) / NEWFS_WORD_BITS;
+    int w      = from / NEWFS_WORD_BITS;
+    uint64_t free_bits;
+
+    if (from >= nbits) {
+        return nbits;
+    }
+    /* 首个字需要屏蔽from之前的位 */
+    free_bits = ~NEWFS_WORD_LOAD(words + w) & (NEWFS_WORD_FULL << (from % NEWFS_WORD_BITS));
+    while (free_bits == 0) {
+        w = newfs_bitmap_skip_full(words, w + 1, nwords);
+        if (w >= nwords) {
+            return nbits;
+        }
+        free_bits = ~NEWFS_WORD_LOAD(words + w);
+    }
+    from = w * NEWFS_WORD_BITS + __builtin_ctzll(free_bits);
+    return from < nbits ? from : nbits;
+}
+
+/**
+ * @brief 找到[from, nbits)中第一个为1的位
+ *
+ * @return int 位下标，找不到返回nbits
+ */
+static int newfs_bitmap_next_one(uint8_t* map, int nbits, int from) {
+    const newfs_word_t* words = (const newfs_word_t*)map;
+    int nwords = (nbits + NEWFS_WORD_BITS - 1) / NEWFS_WORD_BITS;
+    int w      = from / NEWFS_WORD_BITS;
+    uint64_t used_bits;
+
+    if (from >= nbits) {
+        return nbits;
+    }
+    used_bits = NEWFS_WORD_LOAD(words + w) & (NEWFS_WORD_FULL << (from % NEWFS_WORD_BITS));
+    while (used_bits == 0) {
+        if (++w >= nwords) {
+            return nbits;
+        }
+        used_bits = NEWFS_WORD_LOAD(words + w);
+    }
+    from = w * NEWFS_WORD_BITS + __builtin_ctzll(used_bits);
+    return from < nbits ? from : nbits;
+}
+
+static uint64_t newfs_word_mask(int bit, int len) {
+    return len == NEWFS_WORD_BITS ? NEWFS_WORD_FULL : (((uint64_t)1 << len) - 1) << bit;
+}
+
+/* 用CAS把字中mask对应的位从全0置为全1，其中有位已被占用时失败 */
+static boolean newfs_word_claim(newfs_word_t* word, uint64_t mask) {
+    uint64_t old = NEWFS_WORD_LOAD(word);
+    do {
+        if (old & mask) {
+            return FALSE;
+        }
+    } while (!__atomic_compare_exchange_n(word, &old, old | mask, TRUE,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return TRUE;
+}
+
+static void newfs_word_release(newfs_word_t* word, uint64_t mask) {
+    __atomic_fetch_and(word, ~mask, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief 原子地占用[start, start + n)，必须全部空闲，失败时撤销已占用的字
+ *
+ * @return boolean
+ */
+static boolean newfs_bitmap_claim_range(uint8_t* map, int start, int n) {
+    newfs_word_t* words = (newfs_word_t*)map;
+    int pos = start, left = n, bit, len;
+    while (left > 0) {
+        bit = pos % NEWFS_WORD_BITS;
+        len = NEWFS_WORD_BITS - bit < left ? NEWFS_WORD_BITS - bit : left;
+        if (!newfs_word_claim(words + pos / NEWFS_WORD_BITS, newfs_word_mask(bit, len))) {
+            while (start < pos) {                     /* 撤销[start, pos) */
+                bit = start % NEWFS_WORD_BITS;
+                len = NEWFS_WORD_BITS - bit < pos - start ? NEWFS_WORD_BITS - bit : pos - start;
+                newfs_word_release(words + start / NEWFS_WORD_BITS, newfs_word_mask(bit, len));
+                start += len;
+            }
+            return FALSE;
+        }
+        pos  += len;
+        left -= len;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief 在[from, nbits)中查找起点小于limit、长度为n的连续空闲位
+ *
+ * @return int 起点，找不到返回-1
+ */
+static int newfs_bitmap_find_run(uint8_t* map, int nbits, int from, int limit, int n) {
+    int start, end;
+    while (1) {
+        start = newfs_bitmap_next_zero(map, nbits, from);
+        if (start >= limit || start + n > nbits) {
+            return -1;
+        }
+        end = newfs_bitmap_next_one(map, start + n, start);
+        if (end - start >= n) {
+            return start;
+        }
+        from = end;
+    }
+}
+
+/**
+ * @brief 分配连续n个空闲位，从hint处开始查找，必要时从头回绕
+ *
+ * @param map 位图
+ * @param nbits 位图有效位数
+ * @param hint 下一次查找的起点，分配成功后更新
+ * @param n 连续位数
+ * @return int 起始位下标，没有空间返回-1
+ */
+int newfs_bitmap_alloc_run(uint8_t* map, int nbits, int* hint, int n) {
+    int start, pos;
+    int from = (*hint >= 0 && *hint < nbits) ? *hint : 0;
+
+    if (newfs_bitmap_skip_full == NULL) {
+        newfs_bitmap_select_impl();
+    }
+    if (n <= 0 || n > nbits) {
+        return -1;
+    }
+    for (pos = from; ; pos = start + 1) {           /* 先查[from, nbits)，再回绕查[0, from) */
+        start = newfs_bitmap_find_run(map, nbits, pos, nbits, n);
+        if (start < 0) {
+            break;
+        }
+        if (newfs_bitmap_claim_range(map, start, n)) {
+            *hint = start + n < nbits ? start + n : 0;
+            return start;
+        }
+    }
+    for (pos = 0; from > 0; pos = start + 1) {
+        start = newfs_bitmap_find_run(map, nbits, pos, from, n);
+        if (start < 0) {
+            break;
+        }
+        if (newfs_bitmap_claim_range(map, start, n)) {
+            *hint = start + n < nbits ? start + n : 0;
+            return start;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 从start开始尽量多地分配连续空闲位，用于延长已有的连续区
+ *
+ * @param map 位图
+ * @param nbits 位图有效位数
+ * @param start 起始位下标
+ * @param max 最多分配的位数
+ * @return int 实际分配的位数，start已被占用时为0
+ */
+int newfs_bitmap_extend(uint8_t* map, int nbits, int start, int max) {
+    newfs_word_t* words = (newfs_word_t*)map;
+    int pos, end, bit, len, got;
+    uint64_t old, free_run;
+
+    if (start < 0 || start >= nbits || max <= 0) {
+        return 0;
+    }
+    end = start + max < nbits ? start + max : nbits;
+    for (pos = start; pos < end; pos += got) {      /* 逐字占用开头连续的空闲位 */
+        bit = pos % NEWFS_WORD_BITS;
+        len = NEWFS_WORD_BITS - bit < end - pos ? NEWFS_WORD_BITS - bit : end - pos;
+        old = NEWFS_WORD_LOAD(words + pos / NEWFS_WORD_BITS);
+        do {
+            free_run = (~old) >> bit;
+            got = free_run == NEWFS_WORD_FULL ? NEWFS_WORD_BITS : __builtin_ctzll(~free_run);
+            got = got < len ? got : len;
+            if (got == 0) {
+                return pos - start;
+            }
+        } while (!__atomic_compare_exchange_n(words + pos / NEWFS_WORD_BITS, &old,
+                                              old | newfs_word_mask(bit, got), TRUE,
+                                              __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+        if (got < len) {
+            return pos + got - start;
+        }
+    }
+    return end - start;
+}
+
+/**
+ * @brief 分配一个空闲位
+ *
+ * @param map 位图
+ * @param nbits 位图有效位数
+ * @param hint 下一次查找的起点，分配成功后更新
+ * @return int 位下标，没有空间返回-1
+ */
+int newfs_bitmap_alloc(uint8_t* map, int nbits, int* hint) {
+    return newfs_bitmap_alloc_run(map, nbits, hint, 1);
+}
+
+/**
+ * @brief 统计位图中已占用的位数
+ *
+ * @param map 位图
+ * @param nbits 位图有效位数
+ * @return int
+ */
+int newfs_bitmap_count(uint8_t* map, int nbits) {
+    const newfs_word_t* words = (const newfs_word_t*)map;
+    int w, cnt = 0;
+    for (w = 0; w < nbits / NEWFS_WORD_BITS; w++) {
+        cnt += __builtin_popcountll(NEWFS_WORD_LOAD(words + w));
+    }
+    if (nbits % NEWFS_WORD_BITS) {
+        cnt += __builtin_popcountll(NEWFS_WORD_LOAD(words + w) & ((((uint64_t)1) << (nbits % NEWFS_WORD_BITS)) - 1));
+    }
+    return cnt;
+}
+
+/**
+ * @brief 按字原子地读出位图的一段，供写回时在并发分配下取得一致的快照
+ *
+ * @param dst 目标缓冲
+ * @param map 位图
+ * @param bytes 字节数，为8的倍数
+ */
+void newfs_bitmap_copy(uint8_t* dst, uint8_t* map, int bytes) {
+    const newfs_word_t* words = (const newfs_word_t*)map;
+    newfs_word_t* out = (newfs_word_t*)dst;
+    int w;
+    for (w = 0; w < bytes / (int)sizeof(newfs_word_t); w++) {
+        out[w] = NEWFS_WORD_LOAD(words + w);
+    }
+}
+
+/**
+ * @brief 释放一个位，直接由下标计算所在的字与位
+ *
+ * @param map 位图
+ * @param idx 位下标
+ */
+void newfs_bitmap_free(uint8_t* map, int idx) {
+    newfs_word_release((newfs_word_t*)map + idx / NEWFS_WORD_BITS,
+                       (uint64_t)1 << (idx % NEWFS_WORD_BITS));
+}
+
+/**
+ * @brief 批量释放位，下标无需有序，小于0的下标被忽略
+ *
+ * @param map 位图
+ * @param idxs 位下标数组
+ * @param n 数组长度
+ */
+void newfs_bitmap_free_batch(uint8_t* map, const int* idxs, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        if (idxs[i] >= 0) {
+            newfs_bitmap_free(map, idxs[i]);
+        }
+    }
+}
+
+/**
+ * @brief 取得当前线程在位图区间[base, base + nbits)中的分配起点。上一次分配的位置
+ * 仍在区间内时沿用，否则按线程序号取区间的第seq % 16份的开头
+ *
+ * @param which NEWFS_HINT_INO或NEWFS_HINT_DATA
+ * @param base 区间起点
+ * @param nbits 区间位数
+ * @return int* 传给newfs_bitmap_alloc等函数的hint
+ */
+int* newfs_bitmap_hint(int which, int base, int nbits) {
+    int* hint = &newfs_thread_hints[which];
+    if (*hint < base || *hint >= base + nbits) {
+        if (newfs_thread_seq < 0) {
+            newfs_thread_seq = __atomic_fetch_add(&newfs_thread_cnt, 1, __ATOMIC_RELAXED);
+        }
+        *hint = base + NEWFS_ROUND_DOWN(newfs_thread_seq % NEWFS_HINT_SPREAD * (nbits / NEWFS_HINT_SPREAD),
+                                        NEWFS_WORD_BITS);
+    }
+    return hint;
+}
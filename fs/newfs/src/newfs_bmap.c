@@ -0,0 +1,361 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+/******************************************************************************
+* SECTION: 块映射
+* 与ext2相同的多级索引：blk_pointers[0..5]为直接块，blk_pointers[6]为一级间接块，
+* blk_pointers[7]为二级间接块。间接块中每项是一个int型的数据块号，未使用的项为-1。
+* 内存中的inode把全部逻辑块展开到blk_map，间接块只在读入与写回时解析和生成。
+*******************************************************************************/
+
+/**
+ * @brief 保证blk_map至少能容纳nblks项
+ */
+static int newfs_bmap_reserve(struct newfs_inode* inode, int nblks) {
+    int  cap = inode->blk_map_cap > 0 ? inode->blk_map_cap : NEWFS_DATA_PER_FILE;
+    int* blk_map;
+    if (nblks <= inode->blk_map_cap) {
+        return NEWFS_ERROR_NONE;
+    }
+    while (cap < nblks) {
+        cap *= 2;
+    }
+    blk_map = (int*)realloc(inode->blk_map, cap * sizeof(int));
+    if (blk_map == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    inode->blk_map     = blk_map;
+    inode->blk_map_cap = cap;
+    return NEWFS_ERROR_NONE;
+}
+
+static int newfs_bmap_alloc_blk(struct newfs_inode* inode, int* blk) {
+    *blk = newfs_bitmap_alloc(newfs_super.data_map, newfs_super.data_max,
+                              newfs_group_hint(NEWFS_HINT_DATA, newfs_group_data_goal(inode)));
+    if (*blk >= 0) {
+        newfs_map_dirty(newfs_super.data_map_dirty, *blk, 1);
+    }
+    return *blk < 0 ? -NEWFS_ERROR_NOSPACE : NEWFS_ERROR_NONE;
+}
+
+static void newfs_bmap_free_blk(int blk) {
+    newfs_journal_revoke(blk);
+    newfs_bitmap_free(newfs_super.data_map, blk);
+    newfs_map_dirty(newfs_super.data_map_dirty, blk, 1);
+}
+
+/**
+ * @brief 逻辑块lblk需要的间接块尚未分配时先分配
+ */
+static int newfs_bmap_alloc_meta(struct newfs_inode* inode, int lblk) {
+    int i, j;
+    if (lblk < NEWFS_DATA_PER_FILE) {
+        return NEWFS_ERROR_NONE;
+    }
+    if (inode->ind_blk < 0 && newfs_bmap_alloc_blk(inode, &inode->ind_blk) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    if (lblk < NEWFS_DATA_PER_FILE + NEWFS_PTRS_PER_BLK) {
+        return NEWFS_ERROR_NONE;
+    }
+    if (inode->dind_blk < 0) {
+        if (newfs_bmap_alloc_blk(inode, &inode->dind_blk) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        inode->dind_map = (int*)malloc(NEWFS_BLK_SZ());
+        for (j = 0; j < NEWFS_PTRS_PER_BLK; j++) {
+            inode->dind_map[j] = -1;
+        }
+    }
+    i = (lblk - NEWFS_DATA_PER_FILE - NEWFS_PTRS_PER_BLK) / NEWFS_PTRS_PER_BLK;
+    if (inode->dind_map[i] < 0 && newfs_bmap_alloc_blk(inode, &inode->dind_map[i]) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 读出一个间接块中的前n项到blk_map
+ */
+static int newfs_bmap_read_ind(int blk, int* blk_map, int n) {
+    return newfs_driver_read(NEWFS_DATA_OFS(blk), (uint8_t*)blk_map, n * sizeof(int));
+}
+
+/**
+ * @brief 将blk_map中的n项写入一个间接块，其余项填-1
+ */
+static int newfs_bmap_write_ind(int blk, int* blk_map, int n) {
+    int* ptrs = (int*)malloc(NEWFS_BLK_SZ());
+    int  i, ret;
+    for (i = 0; i < NEWFS_PTRS_PER_BLK; i++) {
+        ptrs[i] = i < n ? blk_map[i] : -1;
+    }
+    ret = newfs_meta_write(NEWFS_DATA_OFS(blk), (uint8_t*)ptrs, NEWFS_BLK_SZ());
+    free(ptrs);
+    return ret;
+}
+
+/**
+ * @brief 由磁盘inode的块指针建立内存中的块映射，inode->allocated_nums应已读入
+ *
+ * @param inode 内存inode
+ * @param inode_d 磁盘inode
+ * @return int
+ */
+int newfs_bmap_load(struct newfs_inode* inode, struct newfs_inode_d* inode_d) {
+    int nblks = inode->allocated_nums;
+    int lblk, i, n;
+
+    inode->blk_map     = NULL;
+    inode->blk_map_cap = 0;
+    inode->dind_map    = NULL;
+    inode->ind_blk     = inode_d->blk_pointers[NEWFS_IND_BLK];
+    inode->dind_blk    = inode_d->blk_pointers[NEWFS_DIND_BLK];
+    if (newfs_bmap_reserve(inode, nblks) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (lblk = 0; lblk < nblks && lblk < NEWFS_DATA_PER_FILE; lblk++) {
+        inode->blk_map[lblk] = inode_d->blk_pointers[lblk];
+    }
+    if (lblk < nblks) {
+        n = nblks - lblk < NEWFS_PTRS_PER_BLK ? nblks - lblk : NEWFS_PTRS_PER_BLK;
+        if (newfs_bmap_read_ind(inode->ind_blk, inode->blk_map + lblk, n) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        lblk += n;
+    }
+    if (inode->dind_blk >= 0) {
+        inode->dind_map = (int*)malloc(NEWFS_BLK_SZ());
+        if (newfs_bmap_read_ind(inode->dind_blk, inode->dind_map,
+                                NEWFS_PTRS_PER_BLK) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        for (i = 0; lblk < nblks; i++) {
+            n = nblks - lblk < NEWFS_PTRS_PER_BLK ? nblks - lblk : NEWFS_PTRS_PER_BLK;
+            if (newfs_bmap_read_ind(inode->dind_map[i], inode->blk_map + lblk, n) != NEWFS_ERROR_NONE) {
+                return -NEWFS_ERROR_IO;
+            }
+            lblk += n;
+        }
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/* nblks个数据块需要的间接块数 */
+static int newfs_bmap_meta_cnt(int nblks) {
+    nblks -= NEWFS_DATA_PER_FILE;
+    if (nblks <= 0) {
+        return 0;
+    }
+    if (nblks <= NEWFS_PTRS_PER_BLK) {
+        return 1;
+    }
+    nblks -= NEWFS_PTRS_PER_BLK;
+    return 2 + NEWFS_ROUND_UP(nblks, NEWFS_PTRS_PER_BLK) / NEWFS_PTRS_PER_BLK;
+}
+
+/**
+ * @brief 块映射从from个块变为to个块时，下一次写回最多改动的元数据块数，用于预留日志额度
+ *
+ * 包括inode所在的inode表块、分配或释放的块所在的数据位图块，增长时还有新增的间接块、
+ * 原来最后一个间接块与二级间接块。范围内的块已经分配时按blk_map数出跨过的位图块，
+ * 否则按每块一个位图块估计。释放的间接块不再写回。
+ *
+ * @param inode 内存inode，为NULL时只做估计
+ * @param from 原来的块数
+ * @param to 之后的块数
+ * @return int
+ */
+int newfs_bmap_credits(struct newfs_inode* inode, int from, int to) {
+    int lo = from < to ? from : to, hi = from < to ? to : from;
+    int meta = newfs_bmap_meta_cnt(hi) - newfs_bmap_meta_cnt(lo);
+    int tail = lo <= NEWFS_DATA_PER_FILE ? 0 : (lo <= NEWFS_DATA_PER_FILE + NEWFS_PTRS_PER_BLK ? 1 : 2);
+    int maps = meta, grp = -1, i;
+
+    if (inode != NULL && hi <= inode->allocated_nums) {
+        for (i = lo; i < hi; i++) {                   /* 数据块大多连续，按组的变化计数 */
+            if (NEWFS_GROUP_OF(inode->blk_map[i]) != grp) {
+                grp = NEWFS_GROUP_OF(inode->blk_map[i]);
+                maps++;
+            }
+        }
+    }
+    else {
+        maps += hi - lo;
+    }
+    maps = maps < newfs_super.data_map_blks ? maps : newfs_super.data_map_blks;
+    return 1 + maps + (to > from ? meta + tail : 0);
+}
+
+/**
+ * @brief 写回间接块，并填写磁盘inode的块指针
+ *
+ * @param inode 内存inode
+ * @param inode_d 待写回的磁盘inode
+ * @return int
+ */
+int newfs_bmap_sync(struct newfs_inode* inode, struct newfs_inode_d* inode_d) {
+    int nblks = inode->allocated_nums;
+    int lblk, i, n;
+
+    for (lblk = 0; lblk < NEWFS_DATA_PER_FILE; lblk++) {
+        inode_d->blk_pointers[lblk] = lblk < nblks ? inode->blk_map[lblk] : -1;
+    }
+    inode_d->blk_pointers[NEWFS_IND_BLK]  = inode->ind_blk;
+    inode_d->blk_pointers[NEWFS_DIND_BLK] = inode->dind_blk;
+    if ((inode->flag & NEWFS_FLAG_BMAP_DIRTY) == 0) {  /* 块映射没有变化，间接块无需重写 */
+        return NEWFS_ERROR_NONE;
+    }
+    if (lblk < nblks) {
+        n = nblks - lblk < NEWFS_PTRS_PER_BLK ? nblks - lblk : NEWFS_PTRS_PER_BLK;
+        if (newfs_bmap_write_ind(inode->ind_blk, inode->blk_map + lblk, n) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        lblk += n;
+    }
+    if (inode->dind_blk >= 0) {
+        if (newfs_bmap_write_ind(inode->dind_blk, inode->dind_map,
+                                 NEWFS_PTRS_PER_BLK) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        for (i = 0; lblk < nblks; i++) {
+            n = nblks - lblk < NEWFS_PTRS_PER_BLK ? nblks - lblk : NEWFS_PTRS_PER_BLK;
+            if (newfs_bmap_write_ind(inode->dind_map[i], inode->blk_map + lblk, n) != NEWFS_ERROR_NONE) {
+                return -NEWFS_ERROR_IO;
+            }
+            lblk += n;
+        }
+    }
+    inode->flag &= ~NEWFS_FLAG_BMAP_DIRTY;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 为inode追加nblks个数据块，所需的间接块一并分配；空间不足时回滚，不留下半个分配
+ *
+ * 先分配间接块，避免它们插在数据块中间；数据块优先紧接最后一个连续区（extent）分配，
+ * 不能延长时再找一段足够长的连续空闲块，找不到就把长度减半重试。
+ *
+ * @param inode 内存inode
+ * @param nblks 追加的块数
+ * @return int
+ */
+int newfs_bmap_grow(struct newfs_inode* inode, int nblks) {
+    int old_nums = inode->allocated_nums;
+    int target   = old_nums + nblks;
+    int lblk, start, got, i;
+
+    if (target > NEWFS_MAX_FILE_BLKS ||
+        newfs_bmap_reserve(inode, target) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    inode->flag |= NEWFS_FLAG_INODE_DIRTY | NEWFS_FLAG_BMAP_DIRTY;
+    for (lblk = old_nums; lblk < target; lblk++) {
+        if (newfs_bmap_alloc_meta(inode, lblk) != NEWFS_ERROR_NONE) {
+            newfs_bmap_truncate(inode, old_nums);
+            return -NEWFS_ERROR_NOSPACE;
+        }
+    }
+    while (inode->allocated_nums < target) {
+        got   = 0;
+        start = -1;
+        if (inode->allocated_nums > 0) {              /* 延长最后一个extent */
+            start = inode->blk_map[inode->allocated_nums - 1] + 1;
+            got   = newfs_bitmap_extend(newfs_super.data_map, newfs_super.data_max,
+                                        start, target - inode->allocated_nums);
+        }
+        if (got == 0) {
+            for (got = target - inode->allocated_nums; got > 0; got /= 2) {
+                start = newfs_bitmap_alloc_run(newfs_super.data_map, newfs_super.data_max,
+                                               newfs_group_hint(NEWFS_HINT_DATA, newfs_group_data_goal(inode)),
+                                               got);
+                if (start >= 0) {
+                    break;
+                }
+            }
+        }
+        if (got > 0) {
+            newfs_map_dirty(newfs_super.data_map_dirty, start, got);
+        }
+        if (got == 0) {
+            newfs_bmap_truncate(inode, old_nums);
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        for (i = 0; i < got; i++) {
+            inode->blk_map[inode->allocated_nums++] = start + i;
+        }
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 计算从逻辑块lblk开始、物理上连续的数据块数，即lblk所在extent的剩余长度
+ *
+ * @param inode 内存inode
+ * @param lblk 起始逻辑块
+ * @param max 最多统计的块数
+ * @return int extent长度，起始物理块为inode->blk_map[lblk]
+ */
+int newfs_bmap_extent(struct newfs_inode* inode, int lblk, int max) {
+    int len = 1;
+    while (len < max && lblk + len < inode->allocated_nums &&
+           inode->blk_map[lblk + len] == inode->blk_map[lblk] + len) {
+        len++;
+    }
+    return len;
+}
+
+/**
+ * @brief 将inode的数据块截断为nblks个，释放多余的数据块与不再需要的间接块
+ *
+ * @param inode 内存inode
+ * @param nblks 保留的块数
+ */
+void newfs_bmap_truncate(struct newfs_inode* inode, int nblks) {
+    int i, keep;
+
+    if (nblks < inode->allocated_nums) {
+        newfs_bitmap_free_batch(newfs_super.data_map, inode->blk_map + nblks,
+                                inode->allocated_nums - nblks);
+        for (i = nblks; i < inode->allocated_nums; i++) {
+            newfs_journal_revoke(inode->blk_map[i]);
+            newfs_map_dirty(newfs_super.data_map_dirty, inode->blk_map[i], 1);
+        }
+        inode->allocated_nums = nblks;
+        inode->flag |= NEWFS_FLAG_INODE_DIRTY | NEWFS_FLAG_BMAP_DIRTY;
+    }
+    if (inode->dind_blk >= 0) {
+        keep = nblks - NEWFS_DATA_PER_FILE - NEWFS_PTRS_PER_BLK;
+        keep = keep > 0 ? NEWFS_ROUND_UP(keep, NEWFS_PTRS_PER_BLK) / NEWFS_PTRS_PER_BLK : 0;
+        for (i = keep; i < NEWFS_PTRS_PER_BLK; i++) {
+            if (inode->dind_map[i] >= 0) {
+                newfs_bmap_free_blk(inode->dind_map[i]);
+                inode->dind_map[i] = -1;
+            }
+        }
+        if (keep == 0) {
+            newfs_bmap_free_blk(inode->dind_blk);
+            inode->dind_blk = -1;
+            free(inode->dind_map);
+            inode->dind_map = NULL;
+        }
+    }
+    if (inode->ind_blk >= 0 && nblks <= NEWFS_DATA_PER_FILE) {
+        newfs_bmap_free_blk(inode->ind_blk);
+        inode->ind_blk = -1;
+    }
+}
+
+/**
+ * @brief 释放块映射占用的内存，不改变位图
+ *
+ * @param inode 内存inode
+ */
+void newfs_bmap_free(struct newfs_inode* inode) {
+    free(inode->blk_map);
+    free(inode->dind_map);
+    inode->blk_map     = NULL;
+    inode->dind_map    = NULL;
+    inode->blk_map_cap = 0;
+}
@@ -0,0 +1,345 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options   newfs_options;
+
+/******************************************************************************
+* SECTION: 块缓存
+* 以逻辑块号为键的写回缓存，LRU淘汰。脏块在被淘汰、flush或umount时写回设备。
+* 读写与flush在newfs_cache_mutex下进行，期间只会向下调用设备读写。
+*******************************************************************************/
+static pthread_mutex_t    newfs_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct newfs_buf   newfs_lru;          /* LRU链表哨兵，next为最新，prev为最旧 */
+static struct newfs_buf** newfs_htable  = NULL;
+static int                newfs_hsize   = 0;
+static int                newfs_cache_cap = 0;
+static int                newfs_cache_cnt = 0;
+
+#define NEWFS_HASH(blkno)  ((blkno) & (newfs_hsize - 1))
+
+static void newfs_lru_unlink(struct newfs_buf* buf) {
+    buf->prev->next = buf->next;
+    buf->next->prev = buf->prev;
+}
+
+static void newfs_lru_push_front(struct newfs_buf* buf) {
+    buf->next = newfs_lru.next;
+    buf->prev = &newfs_lru;
+    newfs_lru.next->prev = buf;
+    newfs_lru.next = buf;
+}
+
+static void newfs_hash_remove(struct newfs_buf* buf) {
+    struct newfs_buf** pp = &newfs_htable[NEWFS_HASH(buf->blkno)];
+    while (*pp) {
+        if (*pp == buf) {
+            *pp = buf->hnext;
+            break;
+        }
+        pp = &(*pp)->hnext;
+    }
+    buf->hnext = NULL;
+}
+
+/**
+ * @brief 在缓存中查找逻辑块，不改变LRU顺序
+ *
+ * @param blkno
+ * @return struct newfs_buf* 未命中返回NULL
+ */
+static struct newfs_buf* newfs_cache_peek(int64_t blkno) {
+    struct newfs_buf* buf = newfs_htable[NEWFS_HASH(blkno)];
+    while (buf) {
+        if (buf->blkno == blkno) {
+            return buf;
+        }
+        buf = buf->hnext;
+    }
+    return NULL;
+}
+
+static int newfs_cache_writeback(struct newfs_buf* buf) {
+    if (newfs_dev_write(NEWFS_BLKS_SZ(buf->blkno), buf->data,
+                        NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    buf->flag &= ~NEWFS_FLAG_BUF_DIRTY;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 为逻辑块分配缓冲区，缓存已满时淘汰最久未使用的块（脏块先写回）
+ *
+ * @param blkno
+ * @return struct newfs_buf* 内容未初始化，由调用者填充
+ */
+static struct newfs_buf* newfs_cache_alloc(int64_t blkno) {
+    struct newfs_buf* buf;
+    if (newfs_cache_cnt >= newfs_cache_cap) {
+        buf = newfs_lru.prev;
+        if ((buf->flag & NEWFS_FLAG_BUF_DIRTY) &&
+            newfs_cache_writeback(buf) != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] write back blk %lld error\n", __func__, (long long)buf->blkno);
+            return NULL;
+        }
+        newfs_hash_remove(buf);
+        newfs_lru_unlink(buf);
+    }
+    else {
+        buf = (struct newfs_buf*)malloc(sizeof(struct newfs_buf));
+        buf->data = (uint8_t*)malloc(NEWFS_BLK_SZ());
+        newfs_cache_cnt++;
+    }
+    buf->blkno = blkno;
+    buf->flag  = NEWFS_FLAG_BUF_OCCUPY;
+    buf->hnext = newfs_htable[NEWFS_HASH(blkno)];
+    newfs_htable[NEWFS_HASH(blkno)] = buf;
+    newfs_lru_push_front(buf);
+    return buf;
+}
+
+/**
+ * @brief 在缓冲区与调用者的缓冲之间拷贝二者重叠的部分
+ */
+static void newfs_cache_xfer(struct newfs_buf* buf, int64_t offset, uint8_t* content,
+                             int size, boolean is_write) {
+    int64_t blk_start = NEWFS_BLKS_SZ(buf->blkno);
+    int64_t lo = offset > blk_start ? offset : blk_start;
+    int64_t hi = offset + size < blk_start + NEWFS_BLK_SZ() ?
+             offset + size : blk_start + NEWFS_BLK_SZ();
+    if (is_write) {
+        memcpy(buf->data + (lo - blk_start), content + (lo - offset), hi - lo);
+        buf->flag |= NEWFS_FLAG_BUF_DIRTY;
+    }
+    else {
+        memcpy(content + (lo - offset), buf->data + (lo - blk_start), hi - lo);
+    }
+}
+
+/**
+ * @brief 读写公共路径：命中直接拷贝，连续未命中的块一次批量读入。
+ * 写操作整块覆盖的未命中块不需要先从设备读入。
+ */
+static int newfs_cache_rw(int64_t offset, uint8_t* content, int size, boolean is_write) {
+    int64_t blkno   = offset / NEWFS_BLK_SZ();
+    int64_t blk_end = (offset + size - 1) / NEWFS_BLK_SZ();
+    struct newfs_buf* buf;
+    uint8_t* temp_content;
+    int run, i;
+
+    if (size <= 0) {
+        return NEWFS_ERROR_NONE;
+    }
+
+    while (blkno <= blk_end) {
+        buf = newfs_cache_peek(blkno);
+        if (buf) {
+            newfs_lru_unlink(buf);
+            newfs_lru_push_front(buf);
+            newfs_cache_xfer(buf, offset, content, size, is_write);
+            blkno++;
+            continue;
+        }
+        if (is_write && offset <= NEWFS_BLKS_SZ(blkno) &&
+            offset + size >= NEWFS_BLKS_SZ(blkno + 1)) {
+            buf = newfs_cache_alloc(blkno);
+            if (buf == NULL) {
+                return -NEWFS_ERROR_IO;
+            }
+            newfs_cache_xfer(buf, offset, content, size, is_write);
+            blkno++;
+            continue;
+        }
+        /* 找出从blkno开始连续未命中的块，一次读入；写操作只有首尾块会走到这里 */
+        run = 1;
+        while (!is_write && blkno + run <= blk_end && newfs_cache_peek(blkno + run) == NULL) {
+            run++;
+        }
+        temp_content = (uint8_t*)malloc(NEWFS_BLKS_SZ(run));
+        if (newfs_dev_read(NEWFS_BLKS_SZ(blkno), temp_content,
+                           NEWFS_BLKS_SZ(run)) != NEWFS_ERROR_NONE) {
+            free(temp_content);
+            return -NEWFS_ERROR_IO;
+        }
+        for (i = 0; i < run; i++) {
+            buf = newfs_cache_alloc(blkno + i);
+            if (buf == NULL) {
+                free(temp_content);
+                return -NEWFS_ERROR_IO;
+            }
+            memcpy(buf->data, temp_content + NEWFS_BLKS_SZ(i), NEWFS_BLK_SZ());
+            newfs_cache_xfer(buf, offset, content, size, is_write);
+        }
+        free(temp_content);
+        blkno += run;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 初始化块缓存
+ *
+ * @param capacity 最多缓存的逻辑块数，0表示不使用缓存
+ * @return int
+ */
+int newfs_cache_init(int capacity) {
+    newfs_cache_cap = capacity > 0 ? capacity : 0;
+    newfs_cache_cnt = 0;
+    newfs_lru.next  = &newfs_lru;
+    newfs_lru.prev  = &newfs_lru;
+    if (newfs_cache_cap == 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    newfs_hsize = 1;
+    while (newfs_hsize < 2 * newfs_cache_cap) {
+        newfs_hsize <<= 1;
+    }
+    newfs_htable = (struct newfs_buf**)calloc(newfs_hsize, sizeof(struct newfs_buf*));
+    if (newfs_htable == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 经由缓存读
+ *
+ * @param offset
+ * @param out_content
+ * @param size
+ * @return int
+ */
+int newfs_cache_read(int64_t offset, uint8_t *out_content, int size) {
+    int ret;
+    pthread_mutex_lock(&newfs_cache_mutex);
+    ret = newfs_cache_rw(offset, out_content, size, FALSE);
+    pthread_mutex_unlock(&newfs_cache_mutex);
+    return ret;
+}
+
+/**
+ * @brief 经由缓存写，只标记脏块，写回推迟到淘汰或flush
+ *
+ * @param offset
+ * @param in_content
+ * @param size
+ * @return int
+ */
+int newfs_cache_write(int64_t offset, uint8_t *in_content, int size) {
+    int ret;
+    pthread_mutex_lock(&newfs_cache_mutex);
+    ret = newfs_cache_rw(offset, in_content, size, TRUE);
+    pthread_mutex_unlock(&newfs_cache_mutex);
+    return ret;
+}
+
+/**
+ * @brief 批量读：命中的块从缓存拷贝，未命中的块合成一批直接读入调用者的缓冲，不放入缓存。
+ * 用于把文件块读入inode->data，这些块之后由inode自己持有，再缓存一份没有意义。
+ * 写请求被忽略，由调用者先经newfs_cache_write写入。
+ *
+ * @param ios 请求，偏移与大小都按逻辑块对齐
+ * @param n
+ * @return int
+ */
+int newfs_cache_read_batch(struct newfs_dev_io* ios, int n) {
+    struct newfs_dev_io* miss;
+    struct newfs_buf* buf;
+    int64_t blkno, blk_end;
+    int i, cnt = 0, ret;
+
+    for (i = 0; i < n; i++) {
+        cnt += ios[i].is_write ? 0 : ios[i].size / NEWFS_BLK_SZ();
+    }
+    miss = (struct newfs_dev_io*)malloc((cnt > 0 ? cnt : 1) * sizeof(struct newfs_dev_io));
+    cnt  = 0;
+    pthread_mutex_lock(&newfs_cache_mutex);
+    for (i = 0; i < n; i++) {
+        if (ios[i].is_write) {
+            continue;
+        }
+        blk_end = (ios[i].offset + ios[i].size) / NEWFS_BLK_SZ();
+        for (blkno = ios[i].offset / NEWFS_BLK_SZ(); blkno < blk_end; blkno++) {
+            buf = newfs_cache_peek(blkno);
+            if (buf) {
+                newfs_cache_xfer(buf, ios[i].offset, ios[i].buf, ios[i].size, FALSE);
+                continue;
+            }
+            if (cnt > 0 && miss[cnt - 1].offset + miss[cnt - 1].size == NEWFS_BLKS_SZ(blkno) &&
+                miss[cnt - 1].buf + miss[cnt - 1].size == ios[i].buf + (NEWFS_BLKS_SZ(blkno) - ios[i].offset)) {
+                miss[cnt - 1].size += NEWFS_BLK_SZ();
+                continue;
+            }
+            miss[cnt].offset   = NEWFS_BLKS_SZ(blkno);
+            miss[cnt].buf      = ios[i].buf + (NEWFS_BLKS_SZ(blkno) - ios[i].offset);
+            miss[cnt].size     = NEWFS_BLK_SZ();
+            miss[cnt].is_write = FALSE;
+            cnt++;
+        }
+    }
+    /* 持锁读入，避免与淘汰写回同一块交错 */
+    ret = newfs_dev_submit(miss, cnt);
+    pthread_mutex_unlock(&newfs_cache_mutex);
+    free(miss);
+    return ret;
+}
+
+/**
+ * @brief 将所有脏块一次提交给设备写回，由驱动按块号排序并合并相邻的块
+ *
+ * @return int
+ */
+int newfs_cache_flush() {
+    struct newfs_buf**   dirty;
+    struct newfs_buf*    buf;
+    struct newfs_dev_io* ios;
+    int dirty_cnt = 0, i;
+    int ret;
+
+    if (newfs_cache_cap == 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    pthread_mutex_lock(&newfs_cache_mutex);
+    dirty = (struct newfs_buf**)malloc(newfs_cache_cnt * sizeof(struct newfs_buf*));
+    for (buf = newfs_lru.next; buf != &newfs_lru; buf = buf->next) {
+        if (buf->flag & NEWFS_FLAG_BUF_DIRTY) {
+            dirty[dirty_cnt++] = buf;
+        }
+    }
+    ios = (struct newfs_dev_io*)malloc((dirty_cnt > 0 ? dirty_cnt : 1) * sizeof(struct newfs_dev_io));
+    for (i = 0; i < dirty_cnt; i++) {
+        ios[i].offset   = NEWFS_BLKS_SZ(dirty[i]->blkno);
+        ios[i].buf      = dirty[i]->data;
+        ios[i].size     = NEWFS_BLK_SZ();
+        ios[i].is_write = TRUE;
+    }
+    ret = newfs_dev_submit(ios, dirty_cnt);
+    if (ret == NEWFS_ERROR_NONE) {
+        for (i = 0; i < dirty_cnt; i++) {
+            dirty[i]->flag &= ~NEWFS_FLAG_BUF_DIRTY;
+        }
+    }
+    free(ios);
+    free(dirty);
+    pthread_mutex_unlock(&newfs_cache_mutex);
+    return ret;
+}
+
+/**
+ * @brief 释放缓存占用的内存，调用前应先flush
+ */
+void newfs_cache_destroy() {
+    struct newfs_buf* buf = newfs_lru.next;
+    struct newfs_buf* next;
+    while (buf != &newfs_lru) {
+        next = buf->next;
+        free(buf->data);
+        free(buf);
+        buf = next;
+    }
+    newfs_lru.next  = &newfs_lru;
+    newfs_lru.prev  = &newfs_lru;
+    newfs_cache_cnt = 0;
+    free(newfs_htable);
+    newfs_htable = NULL;
+}
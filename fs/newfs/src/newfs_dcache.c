@@ -0,0 +1,151 @@
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: 路径缓存
+* 以完整路径为键缓存newfs_lookup的结果，包括查找失败的负项。
+* - 新建文件或目录（mknod/mkdir/rename）只会让负项失效，通过增加代数一次性作废；
+* - 删除（unlink/rmdir/rename）让该路径及其下所有路径失效，逐项删除。
+* 共享名字空间锁下的查找与新建会并发访问，缓存由newfs_dcache_mutex保护。未命中时记下
+* 当时的代数，插入负项时使用这个代数，查找期间发生的新建会让该负项直接失效。
+*******************************************************************************/
+static struct newfs_dcache_entry* newfs_dcache[NEWFS_DCACHE_BUCKETS];
+static int                        newfs_dcache_cnt = 0;
+static int                        newfs_dcache_gen = 0;
+static pthread_mutex_t            newfs_dcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void newfs_dcache_free_entry(struct newfs_dcache_entry* entry) {
+    free(entry->path);
+    free(entry);
+    newfs_dcache_cnt--;
+}
+
+/**
+ * @brief 初始化路径缓存
+ */
+void newfs_dcache_init() {
+    memset(newfs_dcache, 0, sizeof(newfs_dcache));
+    newfs_dcache_cnt = 0;
+    newfs_dcache_gen = 0;
+}
+
+static void newfs_dcache_clear() {
+    struct newfs_dcache_entry* entry;
+    int i;
+    for (i = 0; i < NEWFS_DCACHE_BUCKETS; i++) {
+        while ((entry = newfs_dcache[i]) != NULL) {
+            newfs_dcache[i] = entry->next;
+            newfs_dcache_free_entry(entry);
+        }
+    }
+}
+
+/**
+ * @brief 查找路径缓存
+ *
+ * @param path 完整路径
+ * @param is_find 命中时返回该路径是否存在
+ * @param gen 未命中时返回当前代数，插入查找结果时传回
+ * @return struct newfs_dentry* 未命中返回NULL
+ */
+struct newfs_dentry* newfs_dcache_lookup(const char* path, boolean* is_find, int* gen) {
+    uint32_t hash = newfs_name_hash(path);
+    struct newfs_dcache_entry* entry;
+    struct newfs_dentry* dentry = NULL;
+
+    pthread_mutex_lock(&newfs_dcache_mutex);
+    *gen  = newfs_dcache_gen;
+    entry = newfs_dcache[hash % NEWFS_DCACHE_BUCKETS];
+    while (entry) {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+            if (entry->is_find || entry->neg_gen == newfs_dcache_gen) {
+                *is_find = entry->is_find;            /* 过期负项视为未命中，由插入时覆盖 */
+                dentry   = entry->dentry;
+            }
+            break;
+        }
+        entry = entry->next;
+    }
+    pthread_mutex_unlock(&newfs_dcache_mutex);
+    return dentry;
+}
+
+/**
+ * @brief 记录一次查找结果，已存在则覆盖
+ *
+ * @param path 完整路径
+ * @param dentry newfs_lookup的返回值
+ * @param is_find 是否找到
+ * @param gen newfs_dcache_lookup未命中时返回的代数
+ */
+void newfs_dcache_insert(const char* path, struct newfs_dentry* dentry, boolean is_find, int gen) {
+    uint32_t hash = newfs_name_hash(path);
+    struct newfs_dcache_entry** bucket = &newfs_dcache[hash % NEWFS_DCACHE_BUCKETS];
+    struct newfs_dcache_entry*  entry;
+
+    pthread_mutex_lock(&newfs_dcache_mutex);
+    entry = *bucket;
+    while (entry && !(entry->hash == hash && strcmp(entry->path, path) == 0)) {
+        entry = entry->next;
+    }
+    if (entry == NULL) {
+        if (newfs_dcache_cnt >= NEWFS_DCACHE_MAX) {  /* 缓存满时整体清空 */
+            newfs_dcache_clear();
+        }
+        entry = (struct newfs_dcache_entry*)malloc(sizeof(struct newfs_dcache_entry));
+        entry->path = strdup(path);
+        entry->hash = hash;
+        entry->next = *bucket;
+        *bucket     = entry;
+        newfs_dcache_cnt++;
+    }
+    entry->dentry  = dentry;
+    entry->is_find = is_find;
+    entry->neg_gen = gen;
+    pthread_mutex_unlock(&newfs_dcache_mutex);
+}
+
+/**
+ * @brief 作废所有负项，在新建文件或目录后调用
+ */
+void newfs_dcache_invalidate_neg() {
+    pthread_mutex_lock(&newfs_dcache_mutex);
+    newfs_dcache_gen++;
+    pthread_mutex_unlock(&newfs_dcache_mutex);
+}
+
+/**
+ * @brief 作废path以及以path/开头的所有缓存项，在删除或移走path后调用
+ *
+ * @param path 完整路径
+ */
+void newfs_dcache_invalidate(const char* path) {
+    struct newfs_dcache_entry** pp;
+    struct newfs_dcache_entry*  entry;
+    int len = strlen(path);
+    int i;
+
+    pthread_mutex_lock(&newfs_dcache_mutex);
+    for (i = 0; i < NEWFS_DCACHE_BUCKETS; i++) {
+        pp = &newfs_dcache[i];
+        while ((entry = *pp) != NULL) {
+            if (strncmp(entry->path, path, len) == 0 &&
+                (entry->path[len] == '\0' || entry->path[len] == '/')) {
+                *pp = entry->next;
+                newfs_dcache_free_entry(entry);
+            }
+            else {
+                pp = &entry->next;
+            }
+        }
+    }
+    pthread_mutex_unlock(&newfs_dcache_mutex);
+}
+
+/**
+ * @brief 清空路径缓存
+ */
+void newfs_dcache_destroy() {
+    pthread_mutex_lock(&newfs_dcache_mutex);
+    newfs_dcache_clear();
+    pthread_mutex_unlock(&newfs_dcache_mutex);
+}
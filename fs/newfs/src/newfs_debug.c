@@ -30,4 +30,7 @@ void newfs_dump_map() {
         }
         printf("\n");
     }
+    printf("inode used: %d/%d, data used: %d/%d\n",
+           newfs_bitmap_count(newfs_super.ino_map, newfs_super.ino_max), newfs_super.ino_max,
+           newfs_bitmap_count(newfs_super.data_map, newfs_super.data_max), newfs_super.data_max);
 }
\ No newline at end of file
@@ -0,0 +1,154 @@
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: 目录索引
+* 每个目录inode维护一个以文件名哈希为键的开放寻址表，指向其dentrys链表中的目录项。
+* 读入目录（newfs_read_inode）或新建目录项时由newfs_alloc_dentry建立并插入，
+* newfs_drop_dentry时删除，删除留下墓碑，装载过高时扩容重建。
+*******************************************************************************/
+#define NEWFS_DINDEX_INIT_CAP     16
+#define NEWFS_DINDEX_TOMB         ((struct newfs_dentry*)-1)
+
+/**
+ * @brief 字符串哈希（FNV-1a），目录索引与路径缓存共用
+ *
+ * @param fname
+ * @return uint32_t
+ */
+uint32_t newfs_name_hash(const char* fname) {
+    uint32_t hash = 2166136261u;
+    while (*fname) {
+        hash ^= (uint8_t)*fname++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int newfs_dindex_rehash(struct newfs_dir_index* dindex, int capacity) {
+    struct newfs_dentry** old_slots = dindex->slots;
+    int old_capacity = dindex->capacity;
+    struct newfs_dentry** slots;
+    uint32_t pos;
+    int i;
+
+    slots = (struct newfs_dentry**)calloc(capacity, sizeof(struct newfs_dentry*));
+    if (slots == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    dindex->slots    = slots;
+    dindex->capacity = capacity;
+    dindex->used     = 0;
+    for (i = 0; i < old_capacity; i++) {
+        if (old_slots[i] == NULL || old_slots[i] == NEWFS_DINDEX_TOMB) {
+            continue;
+        }
+        pos = newfs_name_hash(old_slots[i]->fname) & (capacity - 1);
+        while (slots[pos] != NULL) {
+            pos = (pos + 1) & (capacity - 1);
+        }
+        slots[pos] = old_slots[i];
+        dindex->used++;
+    }
+    free(old_slots);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将目录项加入目录的名字索引，索引不存在时建立
+ *
+ * @param inode 目录的索引结点
+ * @param dentry 该目录下的一个目录项
+ * @return int
+ */
+int newfs_dindex_insert(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    struct newfs_dir_index* dindex = inode->dindex;
+    uint32_t pos;
+
+    if (dindex == NULL) {
+        dindex = (struct newfs_dir_index*)calloc(1, sizeof(struct newfs_dir_index));
+        if (dindex == NULL ||
+            newfs_dindex_rehash(dindex, NEWFS_DINDEX_INIT_CAP) != NEWFS_ERROR_NONE) {
+            free(dindex);
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        inode->dindex = dindex;
+    }
+    if ((dindex->used + 1) * 4 > dindex->capacity * 3) {   /* 装载因子超过3/4，墓碑居多时原地重建 */
+        if (newfs_dindex_rehash(dindex, (dindex->cnt + 1) * 2 > dindex->capacity ?
+                                dindex->capacity * 2 : dindex->capacity) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+    }
+    pos = newfs_name_hash(dentry->fname) & (dindex->capacity - 1);
+    while (dindex->slots[pos] != NULL && dindex->slots[pos] != NEWFS_DINDEX_TOMB) {
+        pos = (pos + 1) & (dindex->capacity - 1);
+    }
+    if (dindex->slots[pos] == NULL) {
+        dindex->used++;
+    }
+    dindex->slots[pos] = dentry;
+    dindex->cnt++;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将目录项从目录的名字索引中删除
+ *
+ * @param inode 目录的索引结点
+ * @param dentry 该目录下的一个目录项
+ */
+void newfs_dindex_remove(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    struct newfs_dir_index* dindex = inode->dindex;
+    uint32_t pos;
+
+    if (dindex == NULL) {
+        return;
+    }
+    pos = newfs_name_hash(dentry->fname) & (dindex->capacity - 1);
+    while (dindex->slots[pos] != NULL) {
+        if (dindex->slots[pos] == dentry) {
+            dindex->slots[pos] = NEWFS_DINDEX_TOMB;
+            dindex->cnt--;
+            return;
+        }
+        pos = (pos + 1) & (dindex->capacity - 1);
+    }
+}
+
+/**
+ * @brief 在目录中按名字查找目录项
+ *
+ * @param inode 目录的索引结点
+ * @param fname 文件名
+ * @return struct newfs_dentry* 找不到返回NULL
+ */
+struct newfs_dentry* newfs_dindex_find(struct newfs_inode* inode, const char* fname) {
+    struct newfs_dir_index* dindex = inode->dindex;
+    struct newfs_dentry* dentry;
+    uint32_t pos;
+
+    if (dindex == NULL) {
+        return NULL;
+    }
+    pos = newfs_name_hash(fname) & (dindex->capacity - 1);
+    while ((dentry = dindex->slots[pos]) != NULL) {
+        if (dentry != NEWFS_DINDEX_TOMB && strcmp(dentry->fname, fname) == 0) {
+            return dentry;
+        }
+        pos = (pos + 1) & (dindex->capacity - 1);
+    }
+    return NULL;
+}
+
+/**
+ * @brief 释放目录的名字索引
+ *
+ * @param inode 目录的索引结点
+ */
+void newfs_dindex_free(struct newfs_inode* inode) {
+    if (inode->dindex) {
+        free(inode->dindex->slots);
+        free(inode->dindex);
+        inode->dindex = NULL;
+    }
+}
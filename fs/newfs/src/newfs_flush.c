@@ -0,0 +1,152 @@
+#include "../include/newfs.h"
+#include <pthread.h>
+#include <sys/time.h>
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options   newfs_options;
+
+/******************************************************************************
+* SECTION: 后台回写
+* 回写线程每隔flush_interval秒，或脏数据超过flush_dirty_kb时被唤醒，独占名字空间锁，
+* 把有变化的元数据与数据写回，并把块缓存刷到设备。唤醒条件由newfs_flush_mutex保护。
+* 操作的日志额度不足时，也在这里独占名字空间锁提前提交（newfs_flush_retry）；
+* fsync与fsyncdir的元数据同样在这里独占提交（newfs_flush_commit）。
+*******************************************************************************/
+static pthread_mutex_t newfs_flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  newfs_flush_cond  = PTHREAD_COND_INITIALIZER;
+static pthread_t       newfs_flush_thread;
+static boolean         newfs_flush_running = FALSE;
+static boolean         newfs_flush_stop    = FALSE;
+static boolean         newfs_flush_kicked  = FALSE;
+
+/**
+ * @brief 把有变化的内容写回并刷到设备，同时做日志检查点，调用者需独占名字空间锁
+ *
+ * @return int
+ */
+int newfs_flush_all() {
+    if (newfs_sync_fs() != NEWFS_ERROR_NONE ||
+        newfs_journal_checkpoint() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief fsync的元数据部分：独占名字空间锁把全部变化作为一个事务提交，并要求设备落盘，
+ * 调用者不能持有名字空间锁
+ *
+ * 共享锁下其他操作可能已在位图中占用了位而inode尚未写回，只提交一部分会在崩溃后留下
+ * 无主的位，因此这里与回写线程一样提交全部变化，不做检查点。
+ *
+ * @return int
+ */
+int newfs_flush_commit() {
+    int ret = NEWFS_ERROR_NONE;
+    newfs_ns_wrlock();
+    if (newfs_sync_fs() != NEWFS_ERROR_NONE) {
+        ret = -NEWFS_ERROR_IO;
+    }
+    newfs_ns_unlock();
+    /* 映射方式下日志还在页缓存中，要求驱动落盘 */
+    if (ret == NEWFS_ERROR_NONE && ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_SYNC, NULL) < 0) {
+        ret = -NEWFS_ERROR_IO;
+    }
+    return ret;
+}
+
+static void* newfs_flusher(void* arg) {
+    struct timespec deadline;
+    struct timeval  now;
+
+    pthread_mutex_lock(&newfs_flush_mutex);
+    while (!newfs_flush_stop) {
+        gettimeofday(&now, NULL);
+        deadline.tv_sec  = now.tv_sec + newfs_options.flush_interval;
+        deadline.tv_nsec = now.tv_usec * 1000;
+        while (!newfs_flush_stop && !newfs_flush_kicked) {
+            if (pthread_cond_timedwait(&newfs_flush_cond, &newfs_flush_mutex, &deadline) != 0) {
+                break;                                /* 超时 */
+            }
+        }
+        if (newfs_flush_stop) {
+            break;
+        }
+        newfs_flush_kicked = FALSE;
+        pthread_mutex_unlock(&newfs_flush_mutex);
+        newfs_ns_wrlock();
+        if (newfs_flush_all() != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] writeback error\n", __func__);
+        }
+        newfs_ns_unlock();
+        pthread_mutex_lock(&newfs_flush_mutex);
+    }
+    pthread_mutex_unlock(&newfs_flush_mutex);
+    return NULL;
+}
+
+/**
+ * @brief 启动回写线程，flush_interval为0时不启动
+ *
+ * @return int
+ */
+int newfs_flusher_start() {
+    if (newfs_options.flush_interval <= 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    newfs_flush_stop   = FALSE;
+    newfs_flush_kicked = FALSE;
+    if (pthread_create(&newfs_flush_thread, NULL, newfs_flusher, NULL) != 0) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    newfs_flush_running = TRUE;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 停止回写线程并等待其退出，调用者不能持有名字空间锁
+ */
+void newfs_flusher_stop() {
+    if (!newfs_flush_running) {
+        return;
+    }
+    pthread_mutex_lock(&newfs_flush_mutex);
+    newfs_flush_stop = TRUE;
+    pthread_cond_signal(&newfs_flush_cond);
+    pthread_mutex_unlock(&newfs_flush_mutex);
+    pthread_join(newfs_flush_thread, NULL);
+    newfs_flush_running = FALSE;
+}
+
+/**
+ * @brief 脏数据超过阈值时唤醒回写线程
+ */
+void newfs_flusher_kick() {
+    int dirty_blks = __atomic_load_n(&newfs_super.dirty_blks, __ATOMIC_RELAXED);
+    if (newfs_flush_running && newfs_options.flush_dirty_kb > 0 &&
+        (long)NEWFS_BLKS_SZ(dirty_blks) >= (long)newfs_options.flush_dirty_kb * 1024) {
+        pthread_mutex_lock(&newfs_flush_mutex);
+        newfs_flush_kicked = TRUE;
+        pthread_cond_signal(&newfs_flush_cond);
+        pthread_mutex_unlock(&newfs_flush_mutex);
+    }
+}
+
+/**
+ * @brief 操作因日志额度不足返回-NEWFS_ERROR_AGAIN时，独占名字空间锁把已有的变化作为
+ * 一个完整的事务提交，之后由加锁入口重试该操作，调用者不能持有名字空间锁
+ *
+ * @param ret 操作的返回值，提交失败时改为-NEWFS_ERROR_IO
+ * @return boolean 是否需要重试
+ */
+boolean newfs_flush_retry(int* ret) {
+    if (*ret != -NEWFS_ERROR_AGAIN) {
+        return FALSE;
+    }
+    newfs_ns_wrlock();
+    if (newfs_journal_need_commit() && newfs_sync_fs() != NEWFS_ERROR_NONE) {   /* 其他线程可能已经提交 */
+        *ret = -NEWFS_ERROR_IO;
+    }
+    newfs_ns_unlock();
+    return *ret == -NEWFS_ERROR_AGAIN;
+}
@@ -0,0 +1,117 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+/******************************************************************************
+* SECTION: 块组
+* 与ext2相同，超级块与日志之后的空间划分为若干块组，每组依次为inode位图(1)、
+* 数据位图(1)、inode表、数据区。内存中的两个位图是各组位图块的拼接，因此inode号与
+* 数据块号的高位是组号、低位是组内下标（见NEWFS_GROUP_OF）。组内超出容量的位在内存中
+* 置1，分配器因此不会返回跨组的连续块；这些位不写回磁盘，盘上位图只有有效的位。
+*
+* 放置策略：普通文件的inode放在父目录所在的组；目录放在空闲inode不少于平均值的组中
+* 空闲数据块最多的一个，使各目录分散而目录下的文件集中。文件的数据块从inode所在的组
+* （已有数据时为最后一个数据块所在的组）开始查找，本组满时顺延到后面的组。
+*******************************************************************************/
+
+/**
+ * @brief 块组中的inode数
+ *
+ * @param grp 组号
+ * @return int
+ */
+int newfs_group_ino_cnt(int grp) {
+    return newfs_super.group_inos;
+}
+
+/**
+ * @brief 块组中的数据块数，只有最后一组可能少于其他组
+ *
+ * @param grp 组号
+ * @return int
+ */
+int newfs_group_data_cnt(int grp) {
+    int per  = newfs_super.group_blks - NEWFS_GROUP_MAP_BLKS - newfs_super.ino_blks;
+    int left = newfs_super.data_blks - grp * per;
+    return left < per ? left : per;
+}
+
+/**
+ * @brief 读入位图后把各组位图中超出本组容量的位置为已占用
+ */
+void newfs_group_pad() {
+    int grp, n;
+    for (grp = 0; grp < newfs_super.group_cnt; grp++) {
+        n = newfs_super.group_inos;
+        newfs_bitmap_extend(newfs_super.ino_map, newfs_super.ino_max,
+                            NEWFS_GROUP_BASE(grp) + n, NEWFS_MAP_BITS_PER_BLK - n);
+        n = newfs_group_data_cnt(grp);
+        newfs_bitmap_extend(newfs_super.data_map, newfs_super.data_max,
+                            NEWFS_GROUP_BASE(grp) + n, NEWFS_MAP_BITS_PER_BLK - n);
+    }
+}
+
+static int newfs_group_free(uint8_t* map, int grp) {
+    return NEWFS_MAP_BITS_PER_BLK - newfs_bitmap_count(map + NEWFS_BLKS_SZ(grp), NEWFS_MAP_BITS_PER_BLK);
+}
+
+/**
+ * @brief 为新建的inode选择块组
+ *
+ * @param dentry 新inode的目录项，parent与ftype已设置
+ * @return int 组号
+ */
+int newfs_group_ino_goal(struct newfs_dentry* dentry) {
+    int pgrp, grp, i, avg = 0, free_inos, free_data, best, best_data = -1;
+
+    if (dentry->parent == NULL) {
+        return 0;
+    }
+    pgrp = NEWFS_GROUP_OF(dentry->parent->ino);
+    if (dentry->ftype != NEWFS_DIR) {
+        return pgrp;
+    }
+    for (grp = 0; grp < newfs_super.group_cnt; grp++) {
+        avg += newfs_group_free(newfs_super.ino_map, grp);
+    }
+    avg /= newfs_super.group_cnt;
+    best = pgrp;
+    for (i = 0; i < newfs_super.group_cnt; i++) {   /* 从父目录的组开始，相同时优先父目录的组 */
+        grp       = (pgrp + i) % newfs_super.group_cnt;
+        free_inos = newfs_group_free(newfs_super.ino_map, grp);
+        if (free_inos == 0 || free_inos < avg) {
+            continue;
+        }
+        free_data = newfs_group_free(newfs_super.data_map, grp);
+        if (free_data > best_data) {
+            best      = grp;
+            best_data = free_data;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief 为inode追加的数据块选择块组
+ *
+ * @param inode
+ * @return int 组号
+ */
+int newfs_group_data_goal(struct newfs_inode* inode) {
+    if (inode->allocated_nums > 0) {
+        return NEWFS_GROUP_OF(inode->blk_map[inode->allocated_nums - 1]);
+    }
+    return NEWFS_GROUP_OF(inode->ino);
+}
+
+/**
+ * @brief 取得当前线程在指定块组中的分配起点
+ *
+ * @param which NEWFS_HINT_INO或NEWFS_HINT_DATA
+ * @param grp 组号
+ * @return int* 传给newfs_bitmap_alloc等函数的hint
+ */
+int* newfs_group_hint(int which, int grp) {
+    return newfs_bitmap_hint(which, NEWFS_GROUP_BASE(grp),
+                             which == NEWFS_HINT_INO ? newfs_super.group_inos : newfs_group_data_cnt(grp));
+}
@@ -0,0 +1,529 @@
+#include "../include/newfs.h"
+#include <time.h>
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options   newfs_options;
+
+/******************************************************************************
+* SECTION: 元数据日志
+* 超级块、位图块、inode表块、目录项块与间接块统称元数据块。newfs_journal_begin之后，
+* 经newfs_meta_write的写入只改动事务中的块镜像；newfs_journal_commit先把缓存中的
+* 文件数据刷到设备，再把「描述块 + 块镜像 + 提交块」一次顺序写入日志区，最后才把
+* 块镜像写到原位置（经过块缓存，可延迟落盘）。
+*
+* 日志区第0块为日志头，记录第一个尚未检查点的事务的位置与序号。日志区写满、
+* umount或回写线程刷盘时做检查点：缓存全部落盘后，日志头前移到末尾。
+* mount时从日志头开始重放序号连续且提交块校验通过的事务。
+*
+* 被日志记录过、尚未检查点的块若被释放，之后可能作为文件数据重新分配，
+* 重放旧镜像会覆盖新数据，因此此时下一次提交前先做检查点。
+*
+* 一个事务包含一次写回所改动的全部元数据，不能中途拆成两个提交，否则崩溃后只重放出
+* 半个mkdir或rename。为此每个操作在改动之前用newfs_journal_reserve预留它最多改动的
+* 块数，全部预留不超过一个事务的上限；额度不足时操作返回-NEWFS_ERROR_AGAIN，由加锁入口
+* 独占名字空间锁把已有的变化完整提交（newfs_flush_retry）后重试。与原位置内容相同的块
+* 不记入事务，因此一次写回记录的块数不超过上次完整写回以来预留的总数。事务仍然放不下时
+* 写回失败并丢弃整个事务，不会提交其中的一部分。
+*
+* 构建事务时清除的脏标记（inode标志、文件数据脏块、位图组、超级块）记入撤销表，
+* 放弃事务时重新置脏，下一次写回仍会写出这些变化；提交成功后撤销表直接清空。
+*
+* 事务都在独占名字空间锁下构建（回写线程、newfs_flush_retry、fsync的newfs_flush_commit），
+* 位图中的位总与占用它的inode一起提交。newfs_journal_mutex从begin持有到commit，
+* 同一时刻只有一个事务；revoke查询活跃块时也持有它。
+*******************************************************************************/
+struct newfs_journal_blk {
+    int64_t  blkno;                               /* 磁盘上的逻辑块号 */
+    uint8_t* data;
+};
+
+struct newfs_journal_undo {
+    struct newfs_inode* inode;                    /* 数据脏块所属的inode，其余记录为NULL */
+    int*     flag;                                /* 被清除的标志字，位图组记录为NULL */
+    uint8_t* map_dirty;                           /* 位图组的脏标记数组 */
+    int      mask;                                /* 清除的标志位；位图组号；数据块起点 */
+    int      len;                                 /* 数据块数 */
+};
+
+static struct newfs_journal_blk* newfs_txn_blks = NULL;   /* 当前事务中的块镜像 */
+static int      newfs_txn_cnt    = 0;
+static int      newfs_txn_max    = 0;             /* 一个事务最多记录的块数 */
+static boolean  newfs_txn_active = FALSE;
+static struct newfs_journal_undo* newfs_txn_undo = NULL;  /* 本事务清除的脏标记 */
+static int      newfs_undo_cnt   = 0;
+static int      newfs_undo_max   = 0;
+static int      newfs_txn_credits = 0;            /* 上次完整写回以来各操作预留的块数 */
+static boolean  newfs_txn_wanted  = FALSE;        /* 有操作因额度不足等待提交 */
+static int64_t* newfs_live_blks  = NULL;          /* 已提交、尚未检查点的块号 */
+static int      newfs_live_cnt   = 0;
+static boolean  newfs_revoked    = FALSE;         /* 有活跃块被释放，提交前需检查点 */
+static uint32_t newfs_journal_seq;                /* 下一个事务的序号 */
+static int      newfs_journal_start;              /* 第一个未检查点事务所在块 */
+static int      newfs_journal_head;               /* 下一个事务写入的块 */
+static pthread_mutex_t newfs_journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define NEWFS_JOURNAL_OFS(idx)    (newfs_super.journal_offset + NEWFS_BLKS_SZ(idx))
+
+static uint32_t newfs_journal_csum(uint32_t csum, const uint8_t* data, int size) {
+    while (size--) {
+        csum ^= *data++;
+        csum *= 16777619u;
+    }
+    return csum;
+}
+
+static int newfs_journal_write_super() {
+    struct newfs_journal_super jsuper;
+    uint8_t* blk = (uint8_t*)calloc(1, NEWFS_BLK_SZ());
+    int ret;
+
+    jsuper.magic = NEWFS_JOURNAL_MAGIC;
+    jsuper.seq   = newfs_journal_seq;
+    jsuper.start = newfs_journal_start;
+    memcpy(blk, &jsuper, sizeof(jsuper));
+    ret = newfs_dev_write(NEWFS_JOURNAL_OFS(0), blk, NEWFS_BLK_SZ());
+    free(blk);
+    return ret;
+}
+
+/**
+ * @brief 检查点：缓存全部落盘后清空日志
+ *
+ * @return int
+ */
+int newfs_journal_checkpoint() {
+    if (newfs_cache_flush() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (newfs_journal_start == newfs_journal_head && newfs_live_cnt == 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    newfs_journal_start = 1;
+    newfs_journal_head  = 1;
+    newfs_live_cnt      = 0;
+    newfs_revoked       = FALSE;
+    return newfs_journal_write_super();
+}
+
+/**
+ * @brief 重放日志头之后已提交的事务，写回原位置后清空日志
+ *
+ * @return int
+ */
+static int newfs_journal_replay() {
+    struct newfs_journal_desc*   desc;
+    struct newfs_journal_commit* commit;
+    uint8_t* buf = (uint8_t*)malloc(NEWFS_BLKS_SZ(newfs_super.journal_blks));
+    int pos = newfs_journal_start;
+    int cnt, i, replayed = 0;
+    uint32_t csum;
+
+    while (pos + 2 <= newfs_super.journal_blks) {
+        desc = (struct newfs_journal_desc*)buf;
+        if (newfs_dev_read(NEWFS_JOURNAL_OFS(pos), buf, NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+            free(buf);
+            return -NEWFS_ERROR_IO;
+        }
+        cnt = desc->cnt;
+        if (desc->magic != NEWFS_JOURNAL_MAGIC || desc->type != NEWFS_JOURNAL_DESC ||
+            desc->seq != newfs_journal_seq || cnt <= 0 || cnt > newfs_txn_max ||
+            pos + cnt + 2 > newfs_super.journal_blks) {
+            break;
+        }
+        if (newfs_dev_read(NEWFS_JOURNAL_OFS(pos + 1), buf + NEWFS_BLK_SZ(),
+                           NEWFS_BLKS_SZ(cnt + 1)) != NEWFS_ERROR_NONE) {
+            free(buf);
+            return -NEWFS_ERROR_IO;
+        }
+        commit = (struct newfs_journal_commit*)(buf + NEWFS_BLKS_SZ(cnt + 1));
+        csum   = newfs_journal_csum(2166136261u, buf, NEWFS_BLKS_SZ(cnt + 1));
+        if (commit->magic != NEWFS_JOURNAL_MAGIC || commit->type != NEWFS_JOURNAL_COMMIT ||
+            commit->seq != newfs_journal_seq || commit->checksum != csum) {
+            break;                                    /* 未提交完整的事务 */
+        }
+        for (i = 0; i < cnt; i++) {
+            if (newfs_driver_write(NEWFS_BLKS_SZ(desc->blknos[i]), buf + NEWFS_BLKS_SZ(i + 1),
+                                   NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+                free(buf);
+                return -NEWFS_ERROR_IO;
+            }
+        }
+        pos += cnt + 2;
+        newfs_journal_seq++;
+        replayed++;
+    }
+    free(buf);
+    if (replayed == 0 && newfs_journal_start == 1) {  /* 日志本来就是空的 */
+        newfs_journal_head = 1;
+        return NEWFS_ERROR_NONE;
+    }
+    NEWFS_DBG("[%s] replayed %d transactions\n", __func__, replayed);
+    if (newfs_cache_flush() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_journal_start = 1;
+    newfs_journal_head  = 1;
+    return newfs_journal_write_super();
+}
+
+/**
+ * @brief 挂载时初始化日志，格式化时写入空日志头，否则重放日志
+ *
+ * @param is_init 是否刚格式化
+ * @return int
+ */
+int newfs_journal_init(boolean is_init) {
+    struct newfs_journal_super jsuper;
+    int by_desc = (NEWFS_BLK_SZ() - (int)sizeof(struct newfs_journal_desc)) / (int)sizeof(int64_t);
+
+    newfs_txn_max = newfs_super.journal_blks - 3;     /* 去掉日志头、描述块与提交块 */
+    if (newfs_txn_max > by_desc) {
+        newfs_txn_max = by_desc;
+    }
+    newfs_txn_blks  = (struct newfs_journal_blk*)calloc(newfs_txn_max, sizeof(struct newfs_journal_blk));
+    newfs_live_blks = (int64_t*)malloc(newfs_super.journal_blks * sizeof(int64_t));
+    newfs_txn_cnt    = 0;
+    newfs_txn_active = FALSE;
+    newfs_txn_credits = 0;
+    newfs_txn_wanted  = FALSE;
+    newfs_live_cnt   = 0;
+    newfs_revoked    = FALSE;
+    if (newfs_txn_blks == NULL || newfs_live_blks == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+
+    if (is_init) {                                    /* 序号以当前时间为起点，旧格式残留的事务接不上 */
+        newfs_journal_seq   = (uint32_t)time(NULL);
+        newfs_journal_start = 1;
+        newfs_journal_head  = 1;
+        return newfs_journal_write_super();
+    }
+    if (newfs_dev_read(NEWFS_JOURNAL_OFS(0), (uint8_t*)&jsuper, sizeof(jsuper)) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (jsuper.magic != NEWFS_JOURNAL_MAGIC || jsuper.start < 1 ||
+        jsuper.start >= newfs_super.journal_blks) {
+        NEWFS_DBG("[%s] bad journal header\n", __func__);
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_journal_seq   = jsuper.seq;
+    newfs_journal_start = jsuper.start;
+    return newfs_journal_replay();
+}
+
+/**
+ * @brief 释放日志使用的内存
+ */
+void newfs_journal_destroy() {
+    free(newfs_txn_blks);
+    free(newfs_live_blks);
+    free(newfs_txn_undo);
+    newfs_txn_blks  = NULL;
+    newfs_live_blks = NULL;
+    newfs_txn_undo  = NULL;
+    newfs_undo_max  = 0;
+}
+
+/**
+ * @brief 开始一个事务，之后的元数据写入都记入事务，直到newfs_journal_commit前独占日志
+ */
+void newfs_journal_begin() {
+    pthread_mutex_lock(&newfs_journal_mutex);
+    newfs_txn_active = TRUE;
+}
+
+/* 丢弃事务中的块镜像，撤销表中的脏标记重新置上 */
+static void newfs_journal_discard() {
+    struct newfs_journal_undo* undo;
+    int i, j;
+    for (i = 0; i < newfs_txn_cnt; i++) {
+        free(newfs_txn_blks[i].data);
+    }
+    for (i = 0; i < newfs_undo_cnt; i++) {
+        undo = &newfs_txn_undo[i];
+        if (undo->inode != NULL) {
+            for (j = 0; j < undo->len; j++) {
+                newfs_data_set_dirty(undo->inode, undo->mask + j);
+            }
+        }
+        else if (undo->flag != NULL) {
+            *undo->flag |= undo->mask;
+        }
+        else {
+            __atomic_store_n(&undo->map_dirty[undo->mask], TRUE, __ATOMIC_RELAXED);
+        }
+    }
+    newfs_txn_cnt  = 0;
+    newfs_undo_cnt = 0;
+}
+
+static int newfs_journal_do_commit() {
+    struct newfs_journal_desc*   desc;
+    struct newfs_journal_commit* commit;
+    uint8_t* buf;
+    int cnt = newfs_txn_cnt;
+    int i, ret = NEWFS_ERROR_NONE;
+
+    newfs_txn_active = FALSE;
+    if (cnt == 0) {                                   /* 没有元数据变化，只需数据落盘 */
+        ret = newfs_cache_flush();
+        if (ret != NEWFS_ERROR_NONE) {
+            newfs_journal_discard();
+        }
+        newfs_undo_cnt = 0;
+        return ret;
+    }
+    /* 日志放不下，或有已记录的块被释放，先检查点；检查点同时刷出了文件数据 */
+    if (newfs_revoked || newfs_journal_head + cnt + 2 > newfs_super.journal_blks) {
+        ret = newfs_journal_checkpoint();
+    }
+    else {                                            /* 先写数据再提交元数据 */
+        ret = newfs_cache_flush();
+    }
+    if (ret != NEWFS_ERROR_NONE) {                    /* 尚未提交，按放弃处理 */
+        newfs_journal_discard();
+        return -NEWFS_ERROR_IO;
+    }
+
+    buf    = (uint8_t*)calloc(cnt + 2, NEWFS_BLK_SZ());
+    desc   = (struct newfs_journal_desc*)buf;
+    commit = (struct newfs_journal_commit*)(buf + NEWFS_BLKS_SZ(cnt + 1));
+    desc->magic = NEWFS_JOURNAL_MAGIC;
+    desc->type  = NEWFS_JOURNAL_DESC;
+    desc->seq   = newfs_journal_seq;
+    desc->cnt   = cnt;
+    for (i = 0; i < cnt; i++) {
+        desc->blknos[i] = newfs_txn_blks[i].blkno;
+        memcpy(buf + NEWFS_BLKS_SZ(i + 1), newfs_txn_blks[i].data, NEWFS_BLK_SZ());
+    }
+    commit->magic    = NEWFS_JOURNAL_MAGIC;
+    commit->type     = NEWFS_JOURNAL_COMMIT;
+    commit->seq      = newfs_journal_seq;
+    commit->checksum = newfs_journal_csum(2166136261u, buf, NEWFS_BLKS_SZ(cnt + 1));
+    /* 整个事务一次顺序写入，提交块随之落盘即视为提交 */
+    ret = newfs_dev_write(NEWFS_JOURNAL_OFS(newfs_journal_head), buf, NEWFS_BLKS_SZ(cnt + 2));
+    free(buf);
+    if (ret != NEWFS_ERROR_NONE) {
+        newfs_journal_discard();
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_journal_head += cnt + 2;
+    newfs_journal_seq++;
+    newfs_undo_cnt = 0;                               /* 已提交，清除的脏标记不再恢复 */
+
+    for (i = 0; i < cnt; i++) {                       /* 写回原位置，由缓存决定何时落盘 */
+        if (ret == NEWFS_ERROR_NONE) {
+            ret = newfs_driver_write(NEWFS_BLKS_SZ(newfs_txn_blks[i].blkno),
+                                     newfs_txn_blks[i].data, NEWFS_BLK_SZ());
+        }
+        newfs_live_blks[newfs_live_cnt++] = newfs_txn_blks[i].blkno;
+        free(newfs_txn_blks[i].data);
+    }
+    newfs_txn_cnt = 0;
+    return ret;
+}
+
+/**
+ * @brief 提交当前事务：数据落盘，日志顺序写入，再把块镜像写到原位置
+ *
+ * @return int
+ */
+int newfs_journal_commit() {
+    int ret = newfs_journal_do_commit();
+    pthread_mutex_unlock(&newfs_journal_mutex);
+    return ret;
+}
+
+/**
+ * @brief 写回出错时放弃当前事务，块镜像全部丢弃，日志与原位置都不改动，
+ * 构建事务时清除的脏标记重新置上
+ */
+void newfs_journal_abort() {
+    newfs_txn_active = FALSE;
+    newfs_journal_discard();
+    pthread_mutex_unlock(&newfs_journal_mutex);
+}
+
+static int newfs_journal_undo_add(struct newfs_inode* inode, int* flag, uint8_t* map_dirty,
+                                  int mask, int len) {
+    struct newfs_journal_undo* undo;
+    int max;
+    if (!newfs_txn_active) {                          /* 不在事务中的写入直接落到原位置 */
+        return NEWFS_ERROR_NONE;
+    }
+    if (newfs_undo_cnt == newfs_undo_max) {
+        max  = newfs_undo_max > 0 ? newfs_undo_max * 2 : 64;
+        undo = (struct newfs_journal_undo*)realloc(newfs_txn_undo, max * sizeof(struct newfs_journal_undo));
+        if (undo == NULL) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        newfs_txn_undo = undo;
+        newfs_undo_max = max;
+    }
+    undo = &newfs_txn_undo[newfs_undo_cnt++];
+    undo->inode     = inode;
+    undo->flag      = flag;
+    undo->map_dirty = map_dirty;
+    undo->mask      = mask;
+    undo->len       = len;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 清除标志字中的脏标记之前调用，事务放弃时重新置上
+ *
+ * @param flag inode->flag或&newfs_super.sb_dirty
+ * @param mask 将要清除的标志位
+ * @return int 撤销表无法扩充时返回-NEWFS_ERROR_NOSPACE，此时不应清除标记
+ */
+int newfs_journal_undo_flag(int* flag, int mask) {
+    if (mask == 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    return newfs_journal_undo_add(NULL, flag, NULL, mask, 0);
+}
+
+/**
+ * @brief 取走位图组的脏标记之前调用，事务放弃时重新置脏
+ *
+ * @param map_dirty newfs_super.ino_map_dirty或newfs_super.data_map_dirty
+ * @param grp 组号
+ * @return int 同newfs_journal_undo_flag
+ */
+int newfs_journal_undo_map(uint8_t* map_dirty, int grp) {
+    return newfs_journal_undo_add(NULL, NULL, map_dirty, grp, 0);
+}
+
+/**
+ * @brief 清除文件数据脏块之前调用，事务放弃时[blk, blk + len)重新置脏
+ *
+ * 数据已经交给块缓存，放弃事务不会丢失它；重新置脏保证下一次写回与元数据一起提交。
+ *
+ * @param inode
+ * @param blk 文件内的起始块
+ * @param len 块数
+ * @return int 同newfs_journal_undo_flag
+ */
+int newfs_journal_undo_data(struct newfs_inode* inode, int blk, int len) {
+    return newfs_journal_undo_add(inode, NULL, NULL, blk, len);
+}
+
+/**
+ * @brief 操作改动元数据之前预留日志额度
+ *
+ * @param nblks 该操作在下一次写回中最多改动的元数据块数
+ * @return int 成功返回0；额度不足返回-NEWFS_ERROR_AGAIN，提交已有变化后可重试；
+ *             单个操作就超过一个事务的上限时返回-NEWFS_ERROR_NOSPACE
+ */
+int newfs_journal_reserve(int nblks) {
+    int cur = __atomic_load_n(&newfs_txn_credits, __ATOMIC_RELAXED);
+    if (nblks > newfs_txn_max) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    do {
+        if (cur + nblks > newfs_txn_max) {
+            __atomic_store_n(&newfs_txn_wanted, TRUE, __ATOMIC_RELAXED);
+            return -NEWFS_ERROR_AGAIN;
+        }
+    } while (!__atomic_compare_exchange_n(&newfs_txn_credits, &cur, cur + nblks, TRUE,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 是否有操作在等待提交以取得额度
+ *
+ * @return boolean
+ */
+boolean newfs_journal_need_commit() {
+    return __atomic_load_n(&newfs_txn_wanted, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 全部变化已经提交，清空预留的额度，调用者独占名字空间锁
+ */
+void newfs_journal_release() {
+    __atomic_store_n(&newfs_txn_credits, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&newfs_txn_wanted, FALSE, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 数据区的块被释放时调用，该块若在未检查点的事务中，下一次提交前先检查点
+ *
+ * @param blk 数据区中的块号
+ */
+void newfs_journal_revoke(int blk) {
+    int64_t blkno = NEWFS_DATA_OFS(blk) / NEWFS_BLK_SZ();
+    int i;
+    pthread_mutex_lock(&newfs_journal_mutex);
+    for (i = 0; !newfs_revoked && i < newfs_live_cnt; i++) {
+        if (newfs_live_blks[i] == blkno) {
+            newfs_revoked = TRUE;
+        }
+    }
+    pthread_mutex_unlock(&newfs_journal_mutex);
+}
+
+static struct newfs_journal_blk* newfs_txn_find(int64_t blkno) {
+    int i;
+    for (i = 0; i < newfs_txn_cnt; i++) {
+        if (newfs_txn_blks[i].blkno == blkno) {
+            return &newfs_txn_blks[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 元数据写，事务进行中时写入事务的块镜像，否则直接经由驱动写
+ *
+ * 不在事务中的块先读出原内容，写入的部分与之相同时不记入事务。事务已满时返回错误，
+ * 不会先提交一部分。
+ *
+ * @param offset
+ * @param in_content
+ * @param size
+ * @return int
+ */
+int newfs_meta_write(int64_t offset, uint8_t *in_content, int size) {
+    struct newfs_journal_blk* jblk;
+    uint8_t* data;
+    int64_t blkno;
+    int bias, len;
+
+    if (!newfs_txn_active) {
+        return newfs_driver_write(offset, in_content, size);
+    }
+    while (size > 0) {
+        blkno = offset / NEWFS_BLK_SZ();
+        bias  = offset % NEWFS_BLK_SZ();
+        len   = NEWFS_BLK_SZ() - bias < size ? NEWFS_BLK_SZ() - bias : size;
+        if ((jblk = newfs_txn_find(blkno)) == NULL) {
+            data = (uint8_t*)malloc(NEWFS_BLK_SZ());
+            if (newfs_driver_read(NEWFS_BLKS_SZ(blkno), data, NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+                free(data);
+                return -NEWFS_ERROR_IO;
+            }
+            if (memcmp(data + bias, in_content, len) == 0) {      /* 内容没有变化 */
+                free(data);
+            }
+            else if (newfs_txn_cnt == newfs_txn_max) {
+                NEWFS_DBG("[%s] transaction full\n", __func__);
+                free(data);
+                return -NEWFS_ERROR_NOSPACE;
+            }
+            else {
+                jblk = &newfs_txn_blks[newfs_txn_cnt++];
+                jblk->blkno = blkno;
+                jblk->data  = data;
+            }
+        }
+        if (jblk != NULL) {
+            memcpy(jblk->data + bias, in_content, len);
+        }
+        offset     += len;
+        in_content += len;
+        size       -= len;
+    }
+    return NEWFS_ERROR_NONE;
+}
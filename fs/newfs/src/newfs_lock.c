@@ -0,0 +1,122 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+/******************************************************************************
+* SECTION: 锁
+* FUSE默认多线程调用各操作，newfs按以下模型加锁，括号内为加锁顺序，先小后大：
+*
+* (1) 名字空间锁newfs_ns_lock，读写锁，在newfs.c的加锁入口中获取。
+*     - 共享：getattr、readdir、read、write、open、opendir、releasedir、access、
+*       mknod、mkdir、symlink、readlink、flush，以及fsync写出文件数据、fsyncdir检查目录。
+*       这些操作不会释放目录项或inode，共享持有期间指针一直有效；
+*     - 独占：unlink、rmdir、rename，fsync与fsyncdir提交元数据，以及回写线程、
+*       日志额度不足时的提交与umount。
+*       它们会释放目录项或要遍历整棵树写回，独占期间不需要再加其他的树上的锁。
+* (2) 目录inode的lock：读锁下查找名字索引、遍历目录项链表（newfs_lookup、readdir），
+*     写锁下插入目录项（mknod、mkdir、symlink）。查找时逐级加锁，同一时刻只持有一个目录的锁。
+* (3) 普通文件inode的lock：read、getattr持读锁，write、fsync持写锁，保护size、块映射与data。
+*     fsync在写锁下只写出这一个文件的数据，其余inode不会被它读取。
+* (4) 日志锁newfs_journal_mutex：从newfs_journal_begin持有到commit；事务都在独占名字空间锁下
+*     构建，它保护的是共享锁下释放块时newfs_journal_revoke查询的活跃块表。
+* (5) 普通文件inode的fault_lock：互斥锁，在(3)的读锁下保护文件块读入内存、data_res变化
+*     （newfs_data_fault），只串行化同一文件的读入，设备I/O期间不阻塞其他文件。
+*     按需装载inode（dentry->inode从NULL变为有效，newfs_load_inode）按dentry地址取
+*     NEWFS_LOAD_STRIPES个分段锁之一，只有落在同一段的装载互相等待。
+* (6) inode与数据位图不加锁，用CAS占用位（见newfs_bitmap.c），分配起点每线程一份，
+*     位图脏标记用原子操作。
+* (7) 路径缓存、块缓存、设备各自的互斥锁，只在各自模块内部获取，不再向外调用加锁。
+*
+* newfs_super.dirty_blks用原子操作维护。
+*******************************************************************************/
+static pthread_rwlock_t newfs_ns_lock    = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t  newfs_load_mutex[NEWFS_LOAD_STRIPES];
+static pthread_once_t   newfs_load_once  = PTHREAD_ONCE_INIT;
+
+static void newfs_load_mutex_init() {
+    int i;
+    for (i = 0; i < NEWFS_LOAD_STRIPES; i++) {
+        pthread_mutex_init(&newfs_load_mutex[i], NULL);
+    }
+}
+
+/**
+ * @brief 共享获取名字空间锁
+ */
+void newfs_ns_rdlock() {
+    pthread_rwlock_rdlock(&newfs_ns_lock);
+}
+
+/**
+ * @brief 独占获取名字空间锁
+ */
+void newfs_ns_wrlock() {
+    pthread_rwlock_wrlock(&newfs_ns_lock);
+}
+
+/**
+ * @brief 释放名字空间锁
+ */
+void newfs_ns_unlock() {
+    pthread_rwlock_unlock(&newfs_ns_lock);
+}
+
+/**
+ * @brief 读锁inode
+ *
+ * @param inode
+ */
+void newfs_inode_rdlock(struct newfs_inode* inode) {
+    pthread_rwlock_rdlock(&inode->lock);
+}
+
+/**
+ * @brief 写锁inode
+ *
+ * @param inode
+ */
+void newfs_inode_wrlock(struct newfs_inode* inode) {
+    pthread_rwlock_wrlock(&inode->lock);
+}
+
+/**
+ * @brief 释放inode的锁
+ *
+ * @param inode
+ */
+void newfs_inode_unlock(struct newfs_inode* inode) {
+    pthread_rwlock_unlock(&inode->lock);
+}
+
+/**
+ * @brief 取得目录项对应的inode，尚未读入时在该dentry所在的分段锁下读入，保证只读入一次
+ *
+ * @param dentry
+ * @return struct newfs_inode* 读入失败返回NULL
+ */
+struct newfs_inode* newfs_load_inode(struct newfs_dentry* dentry) {
+    struct newfs_inode* inode = __atomic_load_n(&dentry->inode, __ATOMIC_ACQUIRE);
+    pthread_mutex_t*    mutex;
+    if (inode != NULL) {
+        return inode;
+    }
+    pthread_once(&newfs_load_once, newfs_load_mutex_init);
+    mutex = &newfs_load_mutex[((uintptr_t)dentry / sizeof(struct newfs_dentry)) % NEWFS_LOAD_STRIPES];
+    pthread_mutex_lock(mutex);
+    inode = dentry->inode;
+    if (inode == NULL) {
+        inode = newfs_read_inode(dentry, dentry->ino);
+        __atomic_store_n(&dentry->inode, inode, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(mutex);
+    return inode;
+}
+
+/**
+ * @brief 调整全局脏块计数
+ *
+ * @param delta
+ */
+void newfs_dirty_add(int delta) {
+    __atomic_add_fetch(&newfs_super.dirty_blks, delta, __ATOMIC_RELAXED);
+}
@@ -3,63 +3,241 @@
 extern struct newfs_super      newfs_super; 
 extern struct custom_options   newfs_options;
 
+static pthread_mutex_t newfs_dev_mutex = PTHREAD_MUTEX_INITIALIZER;   /* 寻道与传输必须成对执行 */
+
+/* 在设备上寻道后批量读写size_aligned字节，offset与size都已按IO单元对齐 */
+static int newfs_dev_xfer(int64_t offset, uint8_t* buf, int size, boolean is_write) {
+    int ret;
+    pthread_mutex_lock(&newfs_dev_mutex);
+    ddriver_seek(NEWFS_DRIVER(), offset, SEEK_SET);
+    ret = is_write ? ddriver_write_batch(NEWFS_DRIVER(), (char *)buf, size)
+                   : ddriver_read_batch(NEWFS_DRIVER(), (char *)buf, size);
+    pthread_mutex_unlock(&newfs_dev_mutex);
+    return ret < 0 ? -NEWFS_ERROR_IO : NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 驱动读，开启块缓存时经由缓存
+ * 
+ * @param offset 
+ * @param out_content 
+ * @param size 
+ * @return int 
+ */
+int newfs_driver_read(int64_t offset, uint8_t *out_content, int size) {
+    if (newfs_options.cache_blks > 0) {
+        return newfs_cache_read(offset, out_content, size);
+    }
+    return newfs_dev_read(offset, out_content, size);
+}
 /**
- * @brief 驱动读
+ * @brief 驱动写，开启块缓存时写入缓存，由缓存负责写回
+ * 
+ * @param offset 
+ * @param in_content 
+ * @param size 
+ * @return int 
+ */
+int newfs_driver_write(int64_t offset, uint8_t *in_content, int size) {
+    if (newfs_options.cache_blks > 0) {
+        return newfs_cache_write(offset, in_content, size);
+    }
+    return newfs_dev_write(offset, in_content, size);
+}
+/**
+ * @brief 直接读设备，不经过缓存
  * 
  * @param offset 
  * @param out_content 
  * @param size 
  * @return int 
  */
-int newfs_driver_read(int offset, uint8_t *out_content, int size) {
-    int      offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_IO_SZ());
+int newfs_dev_read(int64_t offset, uint8_t *out_content, int size) {
+    if (newfs_super.dev_map != NULL) {                /* 映射方式下直接拷贝，不经过驱动 */
+        if (newfs_dev_map(offset, size) == NULL) {    /* 损坏的块号会越过映射的末尾 */
+            return -NEWFS_ERROR_IO;
+        }
+        memcpy(out_content, newfs_super.dev_map + offset, size);
+        return NEWFS_ERROR_NONE;
+    }
+    int64_t  offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_IO_SZ());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = NEWFS_ROUND_UP((size + bias), NEWFS_IO_SZ());
     uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    // lseek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // read(NEWFS_DRIVER(), cur, NEWFS_IO_SZ());
-        ddriver_read(NEWFS_DRIVER(), cur, NEWFS_IO_SZ());
-        cur          += NEWFS_IO_SZ();
-        size_aligned -= NEWFS_IO_SZ();   
+    /* 连续的多个IO单元一次批量读出，只付一次寻道加一次传输 */
+    if (newfs_dev_xfer(offset_aligned, temp_content, size_aligned, FALSE) != NEWFS_ERROR_NONE) {
+        free(temp_content);
+        return -NEWFS_ERROR_IO;
     }
     memcpy(out_content, temp_content + bias, size);
     free(temp_content);
     return NEWFS_ERROR_NONE;
 }
-int newfs_driver_write(int offset, uint8_t *in_content, int size) {
-    int      offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_IO_SZ());
+/**
+ * @brief 直接写设备，不经过缓存
+ * 
+ * @param offset 
+ * @param in_content 
+ * @param size 
+ * @return int 
+ */
+int newfs_dev_write(int64_t offset, uint8_t *in_content, int size) {
+    int64_t  offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_IO_SZ());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = NEWFS_ROUND_UP((size + bias), NEWFS_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    newfs_driver_read(offset_aligned, temp_content, size_aligned);
+    int64_t  tail_offset    = offset_aligned + size_aligned - NEWFS_IO_SZ();
+    uint8_t* temp_content;
+
+    if (newfs_super.dev_map != NULL) {                /* 映射方式下直接拷贝，不需要按IO单元对齐 */
+        if (newfs_dev_map(offset, size) == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        memcpy(newfs_super.dev_map + offset, in_content, size);
+        return NEWFS_ERROR_NONE;
+    }
+    if (bias == 0 && size == size_aligned) {          /* 首尾都已对齐，无需预读 */
+        if (newfs_dev_xfer(offset_aligned, in_content, size_aligned, TRUE) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        return NEWFS_ERROR_NONE;
+    }
+
+    /* 只预读首尾两个不完整的IO单元，中间的单元会被整体覆盖 */
+    temp_content = (uint8_t*)malloc(size_aligned);
+    if (bias != 0 && (bias + size) % NEWFS_IO_SZ() != 0 && size_aligned <= 2 * NEWFS_IO_SZ()) {
+        newfs_dev_read(offset_aligned, temp_content, size_aligned);   /* 首尾相邻，一次读完 */
+    }
+    else {
+        if (bias != 0) {
+            newfs_dev_read(offset_aligned, temp_content, NEWFS_IO_SZ());
+        }
+        if ((bias + size) % NEWFS_IO_SZ() != 0 && (bias == 0 || tail_offset != offset_aligned)) {
+            newfs_dev_read(tail_offset, temp_content + (tail_offset - offset_aligned), NEWFS_IO_SZ());
+        }
+    }
     memcpy(temp_content + bias, in_content, size);
     
-    // lseek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // write(NEWFS_DRIVER(), cur, NEWFS_IO_SZ());
-        ddriver_write(NEWFS_DRIVER(), cur, NEWFS_IO_SZ());
-        cur          += NEWFS_IO_SZ();
-        size_aligned -= NEWFS_IO_SZ();   
+    if (newfs_dev_xfer(offset_aligned, temp_content, size_aligned, TRUE) != NEWFS_ERROR_NONE) {
+        free(temp_content);
+        return -NEWFS_ERROR_IO;
     }
 
     free(temp_content);
     return NEWFS_ERROR_NONE;
 }
+/**
+ * @brief 一组请求一次提交，开启块缓存时读请求先查缓存、写请求写入缓存
+ *
+ * @param ios
+ * @param n
+ * @return int
+ */
+int newfs_driver_submit(struct newfs_dev_io* ios, int n) {
+    int i;
+    if (newfs_options.cache_blks > 0) {
+        for (i = 0; i < n; i++) {
+            if (ios[i].is_write && newfs_cache_write(ios[i].offset, ios[i].buf, ios[i].size) != NEWFS_ERROR_NONE) {
+                return -NEWFS_ERROR_IO;
+            }
+        }
+        return newfs_cache_read_batch(ios, n);
+    }
+    return newfs_dev_submit(ios, n);
+}
+/**
+ * @brief 一组请求一次提交给驱动的异步队列，只等待一次，不经过缓存
+ *
+ * 驱动按偏移排序并合并相邻的请求，彼此不相邻的块也只付一轮寻道。
+ * 未按IO单元对齐的请求退回到newfs_dev_read/newfs_dev_write。
+ *
+ * @param ios
+ * @param n
+ * @return int
+ */
+int newfs_dev_submit(struct newfs_dev_io* ios, int n) {
+    struct ddriver_req* reqs;
+    int i, cnt = 0, ret = NEWFS_ERROR_NONE;
+
+    if (n <= 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    reqs = (struct ddriver_req*)malloc(n * sizeof(struct ddriver_req));
+    for (i = 0; i < n; i++) {
+        if (newfs_super.dev_map != NULL ||
+            ios[i].offset % NEWFS_IO_SZ() != 0 || ios[i].size % NEWFS_IO_SZ() != 0) {
+            ret = ios[i].is_write ? newfs_dev_write(ios[i].offset, ios[i].buf, ios[i].size)
+                                  : newfs_dev_read(ios[i].offset, ios[i].buf, ios[i].size);
+            if (ret != NEWFS_ERROR_NONE) {
+                break;
+            }
+            continue;
+        }
+        reqs[cnt].offset   = ios[i].offset;
+        reqs[cnt].buf      = (char *)ios[i].buf;
+        reqs[cnt].size     = ios[i].size;
+        reqs[cnt].is_write = ios[i].is_write;
+        cnt++;
+    }
+    if (cnt > 0) {
+        ddriver_submit(NEWFS_DRIVER(), reqs, cnt);
+        if (ddriver_wait(NEWFS_DRIVER(), reqs, cnt) != 0) {
+            ret = -NEWFS_ERROR_IO;
+        }
+    }
+    free(reqs);
+    return ret;
+}
+/**
+ * @brief 取得设备上一段区域在映射中的地址，供读元数据时免去拷贝
+ *
+ * 只在以--mmap挂载时可用，此时块缓存关闭，映射中的内容与newfs_dev_read读到的相同。
+ * 返回的地址只读，修改元数据仍须经过newfs_meta_write以便记入日志。
+ *
+ * @param offset
+ * @param size
+ * @return const uint8_t* 未映射或越界时返回NULL
+ */
+const uint8_t* newfs_dev_map(int64_t offset, int size) {
+    if (newfs_super.dev_map == NULL || offset < 0 || offset + size > NEWFS_DISK_SZ()) {
+        return NULL;
+    }
+    return newfs_super.dev_map + offset;
+}
+/**
+ * @brief 计算目录项记录排在pos之后时的起始位置，本块剩余空间放不下时从下一块开始
+ *
+ * @param pos 上一条记录的末尾
+ * @param rec_len 记录长度
+ * @return int
+ */
+static int newfs_dentry_place(int pos, int rec_len) {
+    if (pos % NEWFS_BLK_SZ() + rec_len > NEWFS_BLK_SZ()) {
+        return NEWFS_ROUND_UP(pos, NEWFS_BLK_SZ());
+    }
+    return pos;
+}
+
 /**
  * @brief 将denry插入到其父目录绑定的inode中，采用头插法
  * 
+ * 磁盘上的记录按插入的先后排列，新目录项排在最后，按dir_bytes判断是否需要新的逻辑块。
+ * 需要新的逻辑块时先分配，分配失败时目录保持不变。
+ *
  * @param inode 
  * @param dentry 
- * @return int 
+ * @return int 目录项数，没有空间时返回-NEWFS_ERROR_NOSPACE
  */
 int newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry, boolean judge) {
+    int rec_len   = NEWFS_DENTRY_D_LEN((int)strlen(dentry->fname));
+    int dir_bytes = newfs_dentry_place(inode->dir_bytes, rec_len) + rec_len;
+    if(judge){
+        /* 已分配的块放不下新目录项时，需要找到新的逻辑块来存 */
+        if(NEWFS_ROUND_UP(dir_bytes, NEWFS_BLK_SZ()) / NEWFS_BLK_SZ() > inode->allocated_nums){
+            if (newfs_bmap_grow(inode, 1) != NEWFS_ERROR_NONE)
+                return -NEWFS_ERROR_NOSPACE;
+        }
+        inode->flag |= NEWFS_FLAG_INODE_DIRTY | NEWFS_FLAG_DENTRY_DIRTY;
+    }
     if (inode->dentrys == NULL) {
         inode->dentrys = dentry;
     }
@@ -67,39 +245,69 @@ int newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry, b
         dentry->brother = inode->dentrys;          //原来的链表头目录变为当前目录的兄弟
         inode->dentrys = dentry;
     }
+    newfs_dindex_insert(inode, dentry);
     inode->dir_cnt++;
-    if(judge){
-        /* 检查位图是否有空位 */
-        if((inode->dir_cnt % NEWFS_DENTRYS_PER_BLK) == 1){ //需要找到新的逻辑块来存
-            int byte_cursor = 0; 
-            int bit_cursor  = 0; 
-            int data_cursor  = 0;
-            boolean is_find_free_entry = FALSE;
-            for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.data_map_blks); //字节位
-                byte_cursor++)
-            {
-                for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {          //比特位
-                    if((newfs_super.data_map[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                            /* 当前data_cursor位置空闲 */
-                        newfs_super.data_map[byte_cursor] |= (0x1 << bit_cursor);
-                        is_find_free_entry = TRUE;           
-                        break;
-                    }
-                    data_cursor++;
-                }
-                if (is_find_free_entry) {
-                    break;
-                }
-            }
-            if (!is_find_free_entry || data_cursor == newfs_super.ino_max)
-                return -NEWFS_ERROR_NOSPACE;
-            /*这里只是为了记录数据块是否被占用*/
-            int cur_blk = inode->dir_cnt / NEWFS_DENTRYS_PER_BLK;
-            inode->blk_pointers[cur_blk] = data_cursor;
+    inode->dir_bytes = dir_bytes;
+    return inode->dir_cnt;
+}
+
+/**
+ * @brief 读出目录的全部目录项块，物理上连续的块一次读入
+ * 
+ * @param inode 目录的inode
+ * @param dentry_blks 至少allocated_nums个块大小的缓冲
+ * @return int 
+ */
+static int newfs_read_dentry_blks(struct newfs_inode* inode, uint8_t* dentry_blks) {
+    for (int i = 0, len; i < inode->allocated_nums; i += len) {
+        len = newfs_bmap_extent(inode, i, inode->allocated_nums);
+        if (newfs_driver_read(NEWFS_DATA_OFS(inode->blk_map[i]), dentry_blks + NEWFS_BLKS_SZ(i),
+                              NEWFS_BLKS_SZ(len)) != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] io error\n", __func__);
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 整块写回目录的全部目录项块，物理上连续的块一次写回
+ * 
+ * @param inode 目录的inode
+ * @param dentry_blks 已排好目录项的缓冲
+ * @return int 
+ */
+static int newfs_write_dentry_blks(struct newfs_inode* inode, uint8_t* dentry_blks) {
+    for (int i = 0, len; i < inode->allocated_nums; i += len) {
+        len = newfs_bmap_extent(inode, i, inode->allocated_nums);
+        if (newfs_meta_write(NEWFS_DATA_OFS(inode->blk_map[i]), dentry_blks + NEWFS_BLKS_SZ(i),
+                             NEWFS_BLKS_SZ(len)) != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] io error\n", __func__);
+            return -NEWFS_ERROR_IO;
         }
+    }
+    return NEWFS_ERROR_NONE;
+}
 
+/**
+ * @brief 释放内存中的inode及其已读入的目录项、名字索引与块映射，不改动位图
+ *
+ * @param inode
+ */
+void newfs_free_inode(struct newfs_inode* inode) {
+    struct newfs_dentry* dentry_cursor = inode->dentrys;
+    struct newfs_dentry* dentry_to_free;
+
+    while (dentry_cursor) {
+        dentry_to_free = dentry_cursor;
+        dentry_cursor  = dentry_cursor->brother;
+        free(dentry_to_free);
     }
-    return inode->dir_cnt;
+    newfs_dindex_free(inode);
+    newfs_bmap_free(inode);
+    pthread_rwlock_destroy(&inode->lock);
+    pthread_mutex_destroy(&inode->fault_lock);
+    free(inode);
 }
 
 /**
@@ -113,118 +321,410 @@ struct newfs_inode* newfs_read_inode(struct newfs_dentry * dentry, int ino) {
     struct newfs_inode* inode = (struct newfs_inode*)malloc(sizeof(struct newfs_inode));
     struct newfs_inode_d inode_d;
     struct newfs_dentry* sub_dentry;
-    struct newfs_dentry_d dentry_d;
-    int    dir_cnt = 0, i;
+    const struct newfs_dentry_d* dentry_d;
+    const uint8_t* blk_data;
+    uint8_t* dentry_blks;
+    char   fname[MAX_NAME_LEN];
+    int    blk, pos;
     /* 从磁盘读索引结点 */
     if (newfs_driver_read(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, 
                         sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
         NEWFS_DBG("[%s] io error\n", __func__);
+        free(inode);
         return NULL;                    
     }
     inode->dir_cnt = 0;
+    inode->dir_bytes = 0;
     inode->ino = inode_d.ino;
     inode->allocated_nums = inode_d.allocated_nums;
     inode->size = inode_d.size;
-    memcpy(inode->target_path, inode_d.target_path, NEWFS_MAX_FILE_NAME);
+    inode->link = inode_d.link;
+    inode->ftype = inode_d.ftype;
+    inode->target_path[0] = '\0';
     inode->dentry = dentry;
     inode->dentrys = NULL;
-    for(int i = 0;i <NEWFS_DATA_PER_FILE; i++){
-        inode->blk_pointers[i] = inode_d.blk_pointers[i];
+    inode->dindex = NULL;
+    inode->dir_ver = 0;
+    inode->open_cnt = 0;
+    inode->data = NULL;
+    inode->data_res = NULL;
+    inode->data_dirty = NULL;
+    inode->flag = 0;
+    inode->blk_map = NULL;
+    inode->blk_map_cap = 0;
+    inode->dind_map = NULL;
+    pthread_rwlock_init(&inode->lock, NULL);
+    pthread_mutex_init(&inode->fault_lock, NULL);
+    if (inode_d.ftype == NEWFS_SYM_LINK && (inode_d.size < 0 || inode_d.size >= NEWFS_MAX_FILE_NAME)) {
+        NEWFS_DBG("[%s] bad symlink size in ino %d\n", __func__, ino);
+        newfs_free_inode(inode);
+        return NULL;
+    }
+    if (inode_d.ftype == NEWFS_SYM_LINK && inode_d.size <= NEWFS_SYMLINK_INLINE_MAX) {
+        /* 短符号链接的目标在块指针区，取出后按没有数据块处理 */
+        memcpy(inode->target_path, inode_d.blk_pointers, inode_d.size);
+        inode->target_path[inode_d.size] = '\0';
+        memset(inode_d.blk_pointers, 0xff, sizeof(inode_d.blk_pointers));
+    }
+    if (newfs_bmap_load(inode, &inode_d) != NEWFS_ERROR_NONE) {
+        NEWFS_DBG("[%s] io error\n", __func__);
+        newfs_free_inode(inode);
+        return NULL;
+    }
+    if (inode_d.ftype == NEWFS_SYM_LINK && inode_d.size > NEWFS_SYMLINK_INLINE_MAX) {
+        if (newfs_driver_read(NEWFS_DATA_OFS(inode->blk_map[0]), (uint8_t *)inode->target_path,
+                              (int)inode_d.size) != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] io error\n", __func__);
+            newfs_free_inode(inode);
+            return NULL;
+        }
+        inode->target_path[inode_d.size] = '\0';
     }
     /* 内存中的inode的数据或子目录项部分也需要读出 */
     if (NEWFS_IS_DIR(inode)) {
-        printf("READ INODE\n");
-        printf("root ino:%d, name%s\n", inode->ino, dentry->fname);
-        printf("root inode offset:%d\n", NEWFS_INO_OFS(ino));
-        dir_cnt = inode_d.dir_cnt;
-        int blk_num = 0;
-        int offset;
-        while(dir_cnt > 0 && blk_num < NEWFS_DATA_PER_FILE){
-            offset = NEWFS_DATA_OFS(inode->blk_pointers[blk_num]);
-            printf("    origin offset:%d\n", offset);
-            while(dir_cnt > 0 && offset + sizeof(struct newfs_dentry_d) < NEWFS_DATA_OFS(inode->blk_pointers[blk_num] + 1))
-            {
-                if (newfs_driver_read(offset, (uint8_t *)&dentry_d, sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE) {
-                    NEWFS_DBG("[%s] io error\n", __func__);
+        dentry_blks = NULL;
+        if (newfs_super.dev_map == NULL) {            /* 映射方式下直接在映射中遍历目录项块 */
+            dentry_blks = (uint8_t *)malloc(NEWFS_BLKS_SZ(inode->allocated_nums > 0 ? inode->allocated_nums : 1));
+            if (newfs_read_dentry_blks(inode, dentry_blks) != NEWFS_ERROR_NONE) {
+                free(dentry_blks);
+                newfs_free_inode(inode);
+                return NULL;
+            }
+        }
+        /* 按rec_len逐条遍历各块，记录按插入先后排列，依次头插即恢复链表顺序 */
+        for (blk = 0; blk < inode->allocated_nums; blk++) {
+            blk_data = dentry_blks != NULL ? dentry_blks + NEWFS_BLKS_SZ(blk)
+                                           : newfs_dev_map(NEWFS_DATA_OFS(inode->blk_map[blk]), NEWFS_BLK_SZ());
+            if (blk_data == NULL) {
+                NEWFS_DBG("[%s] bad dentry block in ino %d\n", __func__, ino);
+                newfs_free_inode(inode);
+                return NULL;
+            }
+            for (pos = 0; pos < NEWFS_BLK_SZ(); pos += dentry_d->rec_len) {
+                dentry_d = (const struct newfs_dentry_d *)(blk_data + pos);
+                if (dentry_d->rec_len < sizeof(struct newfs_dentry_d) ||
+                    pos + dentry_d->rec_len > NEWFS_BLK_SZ() ||
+                    NEWFS_DENTRY_D_LEN(dentry_d->name_len) > dentry_d->rec_len ||
+                    dentry_d->name_len >= MAX_NAME_LEN) {
+                    NEWFS_DBG("[%s] bad dentry record in ino %d\n", __func__, ino);
+                    free(dentry_blks);
+                    newfs_free_inode(inode);
                     return NULL;
                 }
-                sub_dentry = new_dentry(dentry_d.fname, dentry_d.ftype);
+                if (dentry_d->name_len == 0) {
+                    continue;
+                }
+                memcpy(fname, dentry_d->fname, dentry_d->name_len);
+                fname[dentry_d->name_len] = '\0';
+                sub_dentry = new_dentry(fname, dentry_d->ftype);
                 sub_dentry->parent = inode->dentry;
-                sub_dentry->ino    = dentry_d.ino; 
-                printf("    child ino:%d, child_fname%s, child dentry offset:%d\n",dentry_d.ino, dentry_d.fname, offset);
+                sub_dentry->ino    = dentry_d->ino;
                 newfs_alloc_dentry(inode, sub_dentry, FALSE); //读的时候不需要判断是否需要额外分配逻辑块给dentry
-                dir_cnt --;
-                offset += sizeof(struct newfs_dentry_d);
             }
-            blk_num +=1;
         }
+        free(dentry_blks);
     }
-    else if (NEWFS_IS_REG(inode)) {
-        for(int i = 0;i <NEWFS_DATA_PER_FILE; i++){
-            inode->data = (uint8_t *)malloc(NEWFS_BLKS_SZ(NEWFS_DATA_PER_FILE));
-            if(inode->blk_pointers[i] == -1) continue; //如果尚未分配，直接跳过
-            if (newfs_driver_read(NEWFS_DATA_OFS(inode->blk_pointers[i]), (uint8_t *)inode->data + i * NEWFS_BLK_SZ(), NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return NULL;                    
+    /* 普通文件的数据不在这里读，由newfs_data_fault在读写时按块读入 */
+    return inode;
+}
+
+static void newfs_blk_bit_set(uint8_t* map, int blk) {
+    map[blk / UINT8_BITS] |= (0x1 << (blk % UINT8_BITS));
+}
+
+static void newfs_blk_bit_clear(uint8_t* map, int blk) {
+    map[blk / UINT8_BITS] &= (uint8_t)(~(0x1 << (blk % UINT8_BITS)));
+}
+
+/* 标记脏块，同时维护全局脏块计数，供回写线程判断阈值 */
+void newfs_data_set_dirty(struct newfs_inode* inode, int blk) {
+    if (!NEWFS_DATA_DIRTY(inode, blk)) {
+        newfs_blk_bit_set(inode->data_dirty, blk);
+        newfs_dirty_add(1);
+    }
+}
+
+static void newfs_data_clear_dirty(struct newfs_inode* inode, int blk) {
+    if (NEWFS_DATA_DIRTY(inode, blk)) {
+        newfs_blk_bit_clear(inode->data_dirty, blk);
+        newfs_dirty_add(-1);
+    }
+}
+
+/**
+ * @brief 文件的块数变化后调整内存中的文件内容与驻留、脏块位图，[old_nums, allocated_nums)为新分配的块，
+ * 清零并视为已驻留的脏块
+ * 
+ * @param inode 普通文件的inode
+ * @param old_nums 调整前的块数
+ * @return int 
+ */
+int newfs_data_resize(struct newfs_inode* inode, int old_nums) {
+    int      nblks    = inode->allocated_nums;
+    /* 位图按64位字取整，便于newfs_bitmap_count按字统计 */
+    int      res_old  = inode->data ? NEWFS_ROUND_UP(old_nums, 64) / UINT8_BITS : 0;
+    int      res_new  = NEWFS_ROUND_UP(nblks, 64) / UINT8_BITS;
+    uint8_t* data     = (uint8_t *)realloc(inode->data, NEWFS_BLKS_SZ(nblks > 0 ? nblks : 1));
+    uint8_t* data_res = (uint8_t *)realloc(inode->data_res, res_new > 0 ? res_new : 1);
+    uint8_t* data_dirty = (uint8_t *)realloc(inode->data_dirty, res_new > 0 ? res_new : 1);
+    int      blk;
+
+    if (data == NULL || data_res == NULL || data_dirty == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    if (inode->data == NULL) {                        /* 第一次访问，原有的块都未驻留 */
+        old_nums = old_nums < nblks ? old_nums : nblks;
+    }
+    if (res_new > res_old) {
+        memset(data_res + res_old, 0, res_new - res_old);
+        memset(data_dirty + res_old, 0, res_new - res_old);
+    }
+    inode->data       = data;
+    inode->data_res   = data_res;
+    inode->data_dirty = data_dirty;
+    for (blk = old_nums; blk < nblks; blk++) {
+        newfs_blk_bit_set(inode->data_res, blk);
+        newfs_data_set_dirty(inode, blk);
+    }
+    if (nblks > old_nums) {
+        memset(inode->data + NEWFS_BLKS_SZ(old_nums), 0, NEWFS_BLKS_SZ(nblks - old_nums));
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+static int newfs_data_fault_nolock(struct newfs_inode* inode, int64_t offset, int size, boolean is_write) {
+    struct newfs_dev_io* ios;
+    int blk, blk_end, len, cnt = 0, ret;
+
+    if (size <= 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    if (inode->data == NULL && newfs_data_resize(inode, inode->allocated_nums) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    blk_end = (offset + size - 1) / NEWFS_BLK_SZ();
+    blk_end = blk_end < inode->allocated_nums ? blk_end : inode->allocated_nums - 1;
+    if (blk_end < offset / NEWFS_BLK_SZ()) {
+        return NEWFS_ERROR_NONE;
+    }
+    ios = (struct newfs_dev_io*)malloc((blk_end - offset / NEWFS_BLK_SZ() + 1) * sizeof(struct newfs_dev_io));
+    for (blk = offset / NEWFS_BLK_SZ(); blk <= blk_end; blk += len) {
+        len = 1;
+        if (is_write) {
+            newfs_data_set_dirty(inode, blk);
+        }
+        if (NEWFS_DATA_RES(inode, blk)) {
+            continue;
+        }
+        if (is_write && offset <= NEWFS_BLKS_SZ(blk) && offset + size >= NEWFS_BLKS_SZ(blk + 1)) {
+            newfs_blk_bit_set(inode->data_res, blk);
+            continue;
+        }
+        len = newfs_bmap_extent(inode, blk, blk_end - blk + 1);
+        if (is_write) {
+            len = 1;                                  /* 写操作只有首尾两块需要读 */
+        }
+        else {
+            for (int i = 1; i < len; i++) {
+                if (NEWFS_DATA_RES(inode, blk + i)) {
+                    len = i;
+                    break;
+                }
             }
-            printf("    read file:%s, offset:%d\n", inode->dentry->fname, NEWFS_DATA_OFS(inode->blk_pointers[i]));
         }
+        ios[cnt].offset   = NEWFS_DATA_OFS(inode->blk_map[blk]);
+        ios[cnt].buf      = inode->data + NEWFS_BLKS_SZ(blk);
+        ios[cnt].size     = NEWFS_BLKS_SZ(len);
+        ios[cnt].is_write = FALSE;
+        cnt++;
     }
-    return inode;
+    /* 各段一次提交、等待一次，全部读入后才标记为驻留 */
+    ret = newfs_driver_submit(ios, cnt);
+    if (ret != NEWFS_ERROR_NONE) {
+        NEWFS_DBG("[%s] io error\n", __func__);
+        free(ios);
+        return -NEWFS_ERROR_IO;
+    }
+    for (int i = 0; i < cnt; i++) {
+        blk = (ios[i].buf - inode->data) / NEWFS_BLK_SZ();
+        for (len = 0; len < ios[i].size / NEWFS_BLK_SZ(); len++) {
+            newfs_blk_bit_set(inode->data_res, blk + len);
+        }
+    }
+    free(ios);
+    return NEWFS_ERROR_NONE;
 }
+
+/**
+ * @brief 读写文件前，把[offset, offset + size)涉及而尚未驻留的块从磁盘读入。
+ * 连续且物理相邻的未驻留块合为一段，各段一次提交给设备；写操作整块覆盖的块不需要读，
+ * 涉及的块都标记为脏。
+ * 
+ * @param inode 普通文件的inode
+ * @param offset 文件内偏移
+ * @param size 字节数
+ * @param is_write 是否为写操作
+ * @return int 
+ */
+int newfs_data_fault(struct newfs_inode* inode, int64_t offset, int size, boolean is_write) {
+    int ret;
+    pthread_mutex_lock(&inode->fault_lock);           /* 同一文件的多个读者可能同时读入，不同文件互不影响 */
+    ret = newfs_data_fault_nolock(inode, offset, size, is_write);
+    pthread_mutex_unlock(&inode->fault_lock);
+    return ret;
+}
+
 /**
  * @brief 分配一个inode，占用位图
  * 
  * @param dentry 该dentry指向分配的inode
- * @return newfs_inode
+ * @return newfs_inode inode位图已满时返回NULL
  */
 struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry) {
     struct newfs_inode* inode;
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int ino_cursor  = 0;
-    boolean is_find_free_entry = FALSE;
     /* 检查位图是否有空位 */
-    for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.ino_map_blks); //字节位
-         byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {          //比特位
-            if((newfs_super.ino_map[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                      /* 当前ino_cursor位置空闲 */
-                newfs_super.ino_map[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_entry = TRUE;           
-                break;
-            }
-            ino_cursor++;
-        }
-        if (is_find_free_entry) {
-            break;
-        }
+    int ino_cursor;
+    int root_hint = NEWFS_ROOT_INO;                   /* 根目录固定为0号 */
+
+    ino_cursor = newfs_bitmap_alloc(newfs_super.ino_map, newfs_super.ino_max,
+                                    dentry->parent == NULL ? &root_hint :
+                                    newfs_group_hint(NEWFS_HINT_INO, newfs_group_ino_goal(dentry)));
+    if (ino_cursor >= 0) {
+        newfs_map_dirty(newfs_super.ino_map_dirty, ino_cursor, 1);
     }
-    if (!is_find_free_entry || ino_cursor == newfs_super.ino_max){
+    if (ino_cursor < 0){
         printf("分配失败！！\n");
-        return -NEWFS_ERROR_NOSPACE;
+        return NULL;
     }
 
     inode = (struct newfs_inode*)malloc(sizeof(struct newfs_inode));
     inode->ino  = ino_cursor; 
     inode->size = 0;
+    inode->link = 1;
     inode->allocated_nums = 0;
                                                       /* dentry指向inode */
     dentry->inode = inode;
     dentry->ino   = inode->ino;
                                                       /* inode指回dentry */
     inode->dentry = dentry;
+    inode->ftype = dentry->ftype;
+    inode->target_path[0] = '\0';
     inode->dir_cnt = 0;
+    inode->dir_bytes = 0;
     inode->dentrys = NULL;
-    
-    if (NEWFS_IS_REG(inode)) {
-        for(int i = 0;i < NEWFS_DATA_PER_FILE; i++){
-            inode->blk_pointers[i] = -1;           //采用动态分配，初始化-1
-            inode->data = (uint8_t *)malloc(NEWFS_BLKS_SZ(NEWFS_DATA_PER_FILE));
+    inode->dindex = NULL;
+    inode->dir_ver = 0;
+    inode->open_cnt = 0;
+    inode->data = NULL;
+    inode->data_res = NULL;
+    inode->data_dirty = NULL;
+    inode->flag = NEWFS_FLAG_INODE_DIRTY;          //新inode尚未写回
+    inode->blk_map = NULL;                         //采用动态分配，随写入增长
+    inode->blk_map_cap = 0;
+    inode->ind_blk = -1;
+    inode->dind_blk = -1;
+    inode->dind_map = NULL;
+    pthread_rwlock_init(&inode->lock, NULL);
+    pthread_mutex_init(&inode->fault_lock, NULL);
+    return inode;
+}
+
+/**
+ * @brief 把目录的全部目录项排成变长记录，按插入先后（链表的逆序）依次放入各块
+ *
+ * 每块最后一条记录延伸到块尾，没有记录的块放一条覆盖整块的空记录。删除留下的空隙
+ * 在这里被压缩掉，dir_bytes随之更新。
+ *
+ * @param inode 目录的inode
+ * @return uint8_t* allocated_nums个块大小的缓冲，由调用者释放
+ */
+static uint8_t* newfs_pack_dentry_blks(struct newfs_inode* inode) {
+    uint8_t* dentry_blks = (uint8_t *)calloc(inode->allocated_nums > 0 ? inode->allocated_nums : 1, NEWFS_BLK_SZ());
+    struct newfs_dentry** dentrys = (struct newfs_dentry **)malloc(sizeof(struct newfs_dentry*) *
+                                                                  (inode->dir_cnt > 0 ? inode->dir_cnt : 1));
+    struct newfs_dentry*  dentry_cursor;
+    struct newfs_dentry_d* dentry_d, *last = NULL;
+    int i, n = 0, pos = 0, name_len, rec_len;
+
+    for (dentry_cursor = inode->dentrys; dentry_cursor != NULL; dentry_cursor = dentry_cursor->brother) {
+        dentrys[n++] = dentry_cursor;
+    }
+    for (i = n - 1; i >= 0; i--) {
+        name_len = (int)strlen(dentrys[i]->fname);
+        rec_len  = NEWFS_DENTRY_D_LEN(name_len);
+        if (newfs_dentry_place(pos, rec_len) != pos) { /* 上一块的最后一条记录延伸到块尾 */
+            last->rec_len += NEWFS_ROUND_UP(pos, NEWFS_BLK_SZ()) - pos;
+            pos = NEWFS_ROUND_UP(pos, NEWFS_BLK_SZ());
         }
+        dentry_d = (struct newfs_dentry_d *)(dentry_blks + pos);
+        dentry_d->ino      = dentrys[i]->ino;
+        dentry_d->rec_len  = (uint16_t)rec_len;
+        dentry_d->name_len = (uint8_t)name_len;
+        dentry_d->ftype    = (uint8_t)dentrys[i]->ftype;
+        memcpy(dentry_d->fname, dentrys[i]->fname, name_len);
+        last = dentry_d;
+        pos += rec_len;
     }
-    return inode;
+    if (last != NULL) {
+        last->rec_len += NEWFS_ROUND_UP(pos, NEWFS_BLK_SZ()) - pos;
+    }
+    inode->dir_bytes = pos;
+    for (i = NEWFS_ROUND_UP(pos, NEWFS_BLK_SZ()) / NEWFS_BLK_SZ(); i < inode->allocated_nums; i++) {
+        dentry_d = (struct newfs_dentry_d *)(dentry_blks + NEWFS_BLKS_SZ(i));
+        dentry_d->rec_len = (uint16_t)NEWFS_BLK_SZ();
+    }
+    free(dentrys);
+    return dentry_blks;
+}
+
+/**
+ * @brief 把普通文件的脏块按extent写回
+ *
+ * 事务中调用时清除的脏位记入事务；fsync在共享名字空间锁下先单独调用，写出这一个文件的数据。
+ *
+ * @param inode 普通文件，调用者持有其写锁或独占名字空间锁
+ * @return int
+ */
+int newfs_sync_data(struct newfs_inode * inode) {
+    struct newfs_dev_io* ios = NULL;
+    int cnt = 0;
+    if (inode->data) {
+        ios = (struct newfs_dev_io*)malloc((inode->allocated_nums + 1) * sizeof(struct newfs_dev_io));
+    }
+    for(int i = 0, len; inode->data && i < inode->allocated_nums; i += len){ /* 脏块按extent收集，一次提交 */
+        len = newfs_bmap_extent(inode, i, inode->allocated_nums);
+        for (int j = 0; j < len; j++) {           /* 干净的块磁盘上已是最新 */
+            if (!NEWFS_DATA_DIRTY(inode, i + j)) {
+                len = j > 0 ? j : 1;
+                break;
+            }
+        }
+        if (!NEWFS_DATA_DIRTY(inode, i)) {
+            continue;
+        }
+        ios[cnt].offset   = NEWFS_DATA_OFS(inode->blk_map[i]);
+        ios[cnt].buf      = inode->data + i * NEWFS_BLK_SZ();
+        ios[cnt].size     = NEWFS_BLKS_SZ(len);
+        ios[cnt].is_write = TRUE;
+        cnt++;
+    }
+    if (newfs_driver_submit(ios, cnt) != NEWFS_ERROR_NONE) {
+        NEWFS_DBG("[%s] io error\n", __func__);
+        free(ios);
+        return -NEWFS_ERROR_IO;
+    }
+    for (int i = 0; i < cnt; i++) {
+        if (newfs_journal_undo_data(inode, (ios[i].buf - inode->data) / NEWFS_BLK_SZ(),
+                                    ios[i].size / NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+            free(ios);
+            return -NEWFS_ERROR_IO;
+        }
+        for (int j = 0; j < ios[i].size / NEWFS_BLK_SZ(); j++) {
+            newfs_data_clear_dirty(inode, (ios[i].buf - inode->data) / NEWFS_BLK_SZ() + j);
+        }
+    }
+    free(ios);
+    return NEWFS_ERROR_NONE;
 }
 
 /**
@@ -236,98 +736,167 @@ struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry) {
 int newfs_sync_inode(struct newfs_inode * inode) {
     struct newfs_inode_d  inode_d;
     struct newfs_dentry*  dentry_cursor;
-    struct newfs_dentry_d dentry_d;
+    uint8_t* dentry_blks;
     int ino             = inode->ino;
+    boolean is_inline   = NEWFS_IS_SYM_LINK(inode) && inode->size <= NEWFS_SYMLINK_INLINE_MAX;
+    memset(&inode_d, 0, sizeof(struct newfs_inode_d));
     inode_d.ino         = ino;
     inode_d.size        = inode->size;
     inode_d.allocated_nums = inode->allocated_nums;
-    memcpy(inode_d.target_path, inode->target_path, NEWFS_MAX_FILE_NAME);
     inode_d.ftype       = inode->dentry->ftype;
-    inode_d.dir_cnt     = inode->dir_cnt;
-    int offset;
-    for(int i=0; i< NEWFS_DATA_PER_FILE; i++){
-        inode_d.blk_pointers[i] = inode->blk_pointers[i];
-    }
-    /* 先写inode本身 */
-    if (newfs_driver_write(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, 
-                     sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
-        NEWFS_DBG("[%s] io error\n", __func__);
+    inode_d.link        = inode->link;
+    /* 清除的标志记入事务，事务放弃时重新置上 */
+    if (newfs_journal_undo_flag(&inode->flag, inode->flag & (NEWFS_FLAG_INODE_DIRTY | NEWFS_FLAG_BMAP_DIRTY |
+                                                             NEWFS_FLAG_DENTRY_DIRTY)) != NEWFS_ERROR_NONE) {
         return -NEWFS_ERROR_IO;
     }
+    /* 只写回有变化的部分：先写间接块，同时填好inode中的块指针，再写inode本身 */
+    if (inode->flag & (NEWFS_FLAG_INODE_DIRTY | NEWFS_FLAG_BMAP_DIRTY)) {
+        if (newfs_bmap_sync(inode, &inode_d) != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] io error\n", __func__);
+            return -NEWFS_ERROR_IO;
+        }
+        if (is_inline) {                              /* 短符号链接没有数据块，目标放在块指针区 */
+            memset(inode_d.blk_pointers, 0, sizeof(inode_d.blk_pointers));
+            memcpy(inode_d.blk_pointers, inode->target_path, inode->size);
+        }
+        else if (NEWFS_IS_SYM_LINK(inode) && (inode->flag & NEWFS_FLAG_INODE_DIRTY)) {
+            if (newfs_meta_write(NEWFS_DATA_OFS(inode->blk_map[0]), (uint8_t *)inode->target_path,
+                                 (int)inode->size) != NEWFS_ERROR_NONE) {
+                NEWFS_DBG("[%s] io error\n", __func__);
+                return -NEWFS_ERROR_IO;
+            }
+        }
+        if (newfs_meta_write(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, 
+                         sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] io error\n", __func__);
+            return -NEWFS_ERROR_IO;
+        }
+        inode->flag &= ~NEWFS_FLAG_INODE_DIRTY;
+    }
     /* 再写inode下方的数据 */
     if (NEWFS_IS_DIR(inode)) { /* 如果当前inode是目录，那么数据是目录项，且目录项的inode也要写回 */    
-        printf("START WRITE TO DISK\n");
-        printf("root ino:%d\n", ino);
-        printf("root inode offset:%d\n", NEWFS_INO_OFS(ino));
-        printf("root dir_cnt:%d\n",inode_d.dir_cnt);
-        printf("root fname:%s\n", inode->dentry->fname);
-        printf("root type:%d\n", inode->dentry->ftype);     
-        int blk_num = 0;                 
-        dentry_cursor = inode->dentrys;
-        while(dentry_cursor != NULL && blk_num < NEWFS_DATA_PER_FILE){
-            offset = NEWFS_DATA_OFS(inode->blk_pointers[blk_num]);
-            printf("    origin offset:%d\n", offset);
-            while (dentry_cursor != NULL && offset + sizeof(struct newfs_dentry_d) < NEWFS_DATA_OFS(inode->blk_pointers[blk_num] + 1))
-            {
-                memcpy(dentry_d.fname, dentry_cursor->fname, NEWFS_MAX_FILE_NAME);
-                dentry_d.ftype = dentry_cursor->ftype;
-                dentry_d.ino = dentry_cursor->ino;
-                printf("    child ino:%d, child fname %s, child dentry offset:%d\n",dentry_d.ino, dentry_d.fname, offset);
-                if (newfs_driver_write(offset, (uint8_t *)&dentry_d, 
-                                    sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE) {
-                    NEWFS_DBG("[%s] io error\n", __func__);
-                    return -NEWFS_ERROR_IO;                     
-                }
-                
-                if (dentry_cursor->inode != NULL) {
-                    newfs_sync_inode(dentry_cursor->inode);
-                }
+      if (inode->flag & NEWFS_FLAG_DENTRY_DIRTY) {
+        /* 在内存中把目录项按块排好，再整块写回 */
+        dentry_blks = newfs_pack_dentry_blks(inode);
+        if (newfs_write_dentry_blks(inode, dentry_blks) != NEWFS_ERROR_NONE) {
+            free(dentry_blks);
+            return -NEWFS_ERROR_IO;
+        }
+        free(dentry_blks);
+        inode->flag &= ~NEWFS_FLAG_DENTRY_DIRTY;
+      }
 
-                dentry_cursor = dentry_cursor->brother;
-                offset += sizeof(struct newfs_dentry_d);
+        for (dentry_cursor = inode->dentrys; dentry_cursor != NULL; dentry_cursor = dentry_cursor->brother) {
+            if (dentry_cursor->inode != NULL &&          /* 子节点出错时整个事务放弃，不能只提交一部分 */
+                newfs_sync_inode(dentry_cursor->inode) != NEWFS_ERROR_NONE) {
+                return -NEWFS_ERROR_IO;
             }
-            blk_num += 1;
         }
     }
     else if (NEWFS_IS_REG(inode)) { /* 如果当前inode是文件，那么数据是文件内容，直接写即可 */
-        for(int i = 0;i < NEWFS_DATA_PER_FILE; i++){
-            if(inode->blk_pointers[i] == -1) continue; //如果尚未分配，直接跳过
-            if (newfs_driver_write(NEWFS_DATA_OFS(inode->blk_pointers[i]), inode->data + i * NEWFS_BLK_SZ(), NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return -NEWFS_ERROR_IO;
-            }
-            printf("    write file:%s, offset:%d\n", inode->dentry->fname, NEWFS_DATA_OFS(inode->blk_pointers[i]));
-
-        }
+        return newfs_sync_data(inode);
     }
     return NEWFS_ERROR_NONE;
 }
 
+/**
+ * @brief 格式化时由设备大小与每个inode对应的字节数计算布局
+ *
+ * 日志之后划分块组，每组的块数取其余空间的1/NEWFS_GROUP_SPLIT，并限制在
+ * [NEWFS_GROUP_MIN_BLKS, 一个位图块的位数]之间，因此设备越大组越大、组数越多，
+ * 两个位图总是每组一块。每组的inode数为组的字节数除以inode_ratio，向上取整到inode表的
+ * 整块。放不下位图、inode表和至少一个数据块的最后一组舍去。
+ *
+ * @param newfs_super_d 填写布局的超级块
+ */
+static void newfs_format_layout(struct newfs_super_d* newfs_super_d) {
+    int     ratio = newfs_options.inode_ratio > 0 ? newfs_options.inode_ratio : NEWFS_DEFAULT_INODE_RATIO;
+    int64_t rest_blks;
+    int     group_blks, group_inos, last_blks;
+
+    newfs_super_d->sb_offset = NEWFS_SUPER_OFS;
+    newfs_super_d->sb_blks = NEWFS_ROUND_UP(sizeof(struct newfs_super_d), NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
+
+    newfs_super_d->journal_offset = NEWFS_SUPER_OFS + NEWFS_BLKS_SZ(newfs_super_d->sb_blks);
+    newfs_super_d->journal_blks = NEWFS_JOURNAL_BLKS;
+
+    rest_blks  = (int64_t)NEWFS_DISK_SZ() / NEWFS_BLK_SZ() - newfs_super_d->sb_blks - newfs_super_d->journal_blks;
+    group_blks = rest_blks / NEWFS_GROUP_SPLIT;
+    group_blks = group_blks < NEWFS_GROUP_MIN_BLKS ? NEWFS_GROUP_MIN_BLKS : group_blks;
+    group_blks = group_blks > NEWFS_MAP_BITS_PER_BLK ? NEWFS_MAP_BITS_PER_BLK : group_blks;
+    group_inos = NEWFS_ROUND_UP(NEWFS_BLKS_SZ(group_blks) / ratio, NEWFS_INODES_PER_BLK);
+    if (group_inos == 0) {
+        group_inos = NEWFS_INODES_PER_BLK;
+    }
+    if (group_inos > group_blks / 2) {               /* inode表不超过组的一半 */
+        group_inos = NEWFS_ROUND_DOWN(group_blks / 2, NEWFS_INODES_PER_BLK);
+    }
+    newfs_super_d->group_blks = group_blks;
+    newfs_super_d->group_inos = group_inos;
+    newfs_super_d->ino_blks = group_inos / NEWFS_INODES_PER_BLK;
+    newfs_super_d->group_cnt = NEWFS_ROUND_UP(rest_blks, group_blks) / group_blks;
+    last_blks = rest_blks - (int64_t)(newfs_super_d->group_cnt - 1) * group_blks;
+    if (last_blks <= NEWFS_GROUP_MAP_BLKS + newfs_super_d->ino_blks) {
+        newfs_super_d->group_cnt--;
+        last_blks = group_blks;
+    }
+
+    newfs_super_d->ino_map_offset = newfs_super_d->journal_offset + NEWFS_BLKS_SZ(newfs_super_d->journal_blks);
+    newfs_super_d->ino_map_blks = newfs_super_d->group_cnt;
+    newfs_super_d->data_map_offset = newfs_super_d->ino_map_offset + NEWFS_BLK_SZ();
+    newfs_super_d->data_map_blks = newfs_super_d->group_cnt;
+    newfs_super_d->ino_offset = newfs_super_d->data_map_offset + NEWFS_BLK_SZ();
+    newfs_super_d->ino_max = NEWFS_GROUP_BASE(newfs_super_d->group_cnt);
+    newfs_super_d->data_offset = newfs_super_d->ino_offset + NEWFS_BLKS_SZ(newfs_super_d->ino_blks);
+    newfs_super_d->data_blks = (newfs_super_d->group_cnt - 1) * group_blks + last_blks -
+                               newfs_super_d->group_cnt * (NEWFS_GROUP_MAP_BLKS + newfs_super_d->ino_blks);
+    newfs_super_d->data_max = NEWFS_GROUP_BASE(newfs_super_d->group_cnt);
+    newfs_super_d->usage_size = 0;
+
+    NEWFS_DBG("groups: %d x %d blocks, last %d\n", newfs_super_d->group_cnt, group_blks, last_blks);
+    NEWFS_DBG("inodes per group: %d (%d blocks)\n", group_inos, newfs_super_d->ino_blks);
+    NEWFS_DBG("data blocks: %d\n", newfs_super_d->data_blks);
+    NEWFS_DBG("journal_offset: %lld\n", (long long)newfs_super_d->journal_offset);
+    NEWFS_DBG("ino_offset: %lld\n", (long long)newfs_super_d->ino_offset);
+    NEWFS_DBG("data_offset: %lld\n", (long long)newfs_super_d->data_offset);
+}
+
 int  newfs_mount(struct custom_options options){
     int                 ret = NEWFS_ERROR_NONE;
     int                 driver_fd;
     struct newfs_super_d  newfs_super_d; 
     struct newfs_dentry*  root_dentry;
     struct newfs_inode*   root_inode;
-    int                 inode_num;
-    int                 inode_blks;
-    int                 ino_map_blks;
-    
-    int                 super_blks;
+    int                 grp;
     boolean             is_init = FALSE;
 
     newfs_super.is_mounted = FALSE;
 
-	driver_fd = ddriver_open(newfs_options.device);
+	driver_fd = ddriver_open_flags(newfs_options.device,
+	                               (newfs_options.mmap   ? DDRIVER_OPEN_MMAP   : 0) |
+	                               (newfs_options.uring  ? DDRIVER_OPEN_URING  : 0) |
+	                               (newfs_options.direct ? DDRIVER_OPEN_DIRECT : 0));
 	 if (driver_fd < 0) {
         return driver_fd;
     }
     newfs_super.driver_fd = driver_fd;
+    newfs_super.dev_map = NULL;
+    if (newfs_options.mmap) {
+        ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_MAP, &newfs_super.dev_map);
+    }
+    if (newfs_super.dev_map != NULL) {                /* 映射本身就是缓存，不再另设块缓存 */
+        newfs_options.cache_blks = 0;
+    }
 
     ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_SIZE, &newfs_super.disk_size);
 	ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &newfs_super.io_size);
 	newfs_super.blk_size = 2 * NEWFS_IO_SZ();
 
+    if (newfs_cache_init(newfs_options.cache_blks) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+
 	root_dentry = new_dentry("/", NEWFS_DIR);
 
 	if(newfs_driver_read(NEWFS_SUPER_OFS,  (uint8_t *)(&newfs_super_d), sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE){
@@ -335,49 +904,25 @@ int  newfs_mount(struct custom_options options){
 	}
 
     printf("d_magic:%d\n", newfs_super_d.magic_num);
-    printf("%d\n",newfs_super_d.data_offset);
     printf("START READ FROM DISK\n");
+	if(newfs_super_d.magic_num == NEWFS_MAGIC_NUM && newfs_super_d.version != NEWFS_VERSION){
+		NEWFS_DBG("[%s] unsupported disk format version %u\n", __func__, newfs_super_d.version);
+		return -NEWFS_ERROR_UNSUPPORTED;
+	}
 	if(newfs_super_d.magic_num != NEWFS_MAGIC_NUM){
-		super_blks = NEWFS_ROUND_UP(sizeof(struct newfs_super_d), NEWFS_BLK_SZ())/ NEWFS_BLK_SZ();
-		inode_num = NEWFS_DISK_SZ()/((NEWFS_DATA_PER_FILE + NEWFS_INODE_PER_FILE) * NEWFS_BLK_SZ()); 
-
-        inode_blks = NEWFS_ROUND_UP(inode_num, NEWFS_INODES_PER_BLK) /NEWFS_INODES_PER_BLK;
-		ino_map_blks = NEWFS_ROUND_UP(NEWFS_ROUND_UP(inode_blks, UINT32_BITS), NEWFS_BLK_SZ())/NEWFS_BLK_SZ(); 
-		
-		newfs_super_d.sb_offset = NEWFS_SUPER_OFS;
-		newfs_super_d.sb_blks = super_blks;
-
-		newfs_super_d.ino_map_offset = NEWFS_SUPER_OFS + NEWFS_BLKS_SZ(newfs_super_d.sb_blks);
-		newfs_super_d.ino_map_blks = ino_map_blks;
-
-		newfs_super_d.data_map_offset = newfs_super_d.ino_map_offset + NEWFS_BLKS_SZ(newfs_super_d.ino_map_blks);
-		newfs_super_d.data_map_blks = 1;
-
-		newfs_super_d.ino_offset = newfs_super_d.data_map_offset + NEWFS_BLKS_SZ(newfs_super_d.data_map_blks);
-		newfs_super_d.ino_blks = inode_blks;
-
-        newfs_super.ino_max = newfs_super_d.ino_blks;
-
-		newfs_super_d.data_offset =newfs_super_d.ino_offset + NEWFS_BLKS_SZ(newfs_super_d.ino_blks);
-		newfs_super_d.data_blks = NEWFS_ROUND_DOWN(NEWFS_DISK_SZ(), NEWFS_BLK_SZ())/NEWFS_BLK_SZ() - newfs_super_d.sb_blks - newfs_super_d.ino_map_blks - newfs_super_d.data_map_blks - newfs_super_d.ino_blks;
-		newfs_super_d.usage_size = 0;
-
-        newfs_super.data_max =  newfs_super_d.data_blks;
-		NEWFS_DBG("inode map blocks: %d\n", ino_map_blks);
-        NEWFS_DBG("disk_size: %d\n", newfs_super_d.disk_size);
-        NEWFS_DBG("inode_num: %d\n", inode_num);
-        NEWFS_DBG("inode_blks: %d\n", newfs_super_d.ino_blks);
-        NEWFS_DBG("ino_map_blks: %d\n", newfs_super_d.ino_map_blks);
-        NEWFS_DBG("ino_map_offset: %d\n", newfs_super_d.ino_map_offset);
-        NEWFS_DBG("data_map_offset: %d\n", newfs_super_d.data_map_offset);
-        NEWFS_DBG("ino_offset: %d\n", newfs_super_d.ino_offset);
-        NEWFS_DBG("data_offset: %d\n", newfs_super_d.data_offset);
+        newfs_format_layout(&newfs_super_d);
 		is_init = TRUE;
 	}
 	newfs_super.usage_size = newfs_super_d.usage_size;
+    newfs_super.ino_max = newfs_super_d.ino_max;
+    newfs_super.data_max = newfs_super_d.data_max;
     /*超级块建立*/
     newfs_super.sb_blks = newfs_super_d.sb_blks;
     newfs_super.sb_offset = newfs_super_d.sb_offset;
+    /*块组*/
+    newfs_super.group_cnt = newfs_super_d.group_cnt;
+    newfs_super.group_blks = newfs_super_d.group_blks;
+    newfs_super.group_inos = newfs_super_d.group_inos;
 
     /*索引位图建立*/
     newfs_super.ino_map_blks = newfs_super_d.ino_map_blks;
@@ -390,33 +935,57 @@ int  newfs_mount(struct custom_options options){
     newfs_super.data_map_blks = newfs_super_d.data_map_blks;
     newfs_super.data_map_offset = newfs_super_d.data_map_offset;
     newfs_super.data_map = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super_d.data_map_blks));
+    /*日志区建立*/
+    newfs_super.journal_blks = newfs_super_d.journal_blks;
+    newfs_super.journal_offset = newfs_super_d.journal_offset;
     /*数据块建立*/
     newfs_super.data_blks =  newfs_super_d.data_blks;
 	newfs_super.data_offset = newfs_super_d.data_offset;
 
+    /*重放日志，之后读到的位图与inode都是最后一次提交后的状态*/
+    if (newfs_journal_init(is_init) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+
 	// newfs_dump_map();
 
 	printf("\n--------------------------------------------------------------------------------\n\n");
 	
-	if (newfs_driver_read(newfs_super_d.ino_map_offset, (uint8_t *)(newfs_super.ino_map), 
-                        NEWFS_BLKS_SZ(newfs_super_d.ino_map_blks)) != NEWFS_ERROR_NONE) {
-        return -NEWFS_ERROR_IO;
+    for (grp = 0; grp < newfs_super.group_cnt; grp++) {  /* 各组的位图块拼接成内存中的位图 */
+        if (newfs_driver_read(newfs_super.ino_map_offset + NEWFS_GROUP_OFS(grp),
+                              newfs_super.ino_map + NEWFS_BLKS_SZ(grp), NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE ||
+            newfs_driver_read(newfs_super.data_map_offset + NEWFS_GROUP_OFS(grp),
+                              newfs_super.data_map + NEWFS_BLKS_SZ(grp), NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
     }
-
-    if (newfs_driver_read(newfs_super_d.data_map_offset, (uint8_t *)(newfs_super.data_map), 
-                        NEWFS_BLKS_SZ(newfs_super_d.data_map_blks)) != NEWFS_ERROR_NONE) {
-        return -NEWFS_ERROR_IO;
+    newfs_super.ino_map_dirty  = (uint8_t *)calloc(newfs_super.ino_map_blks, sizeof(uint8_t));
+    newfs_super.data_map_dirty = (uint8_t *)calloc(newfs_super.data_map_blks, sizeof(uint8_t));
+    newfs_super.sb_dirty = is_init;
+    newfs_super.dirty_blks = 0;
+    if (is_init) {                                    /* 格式化时位图从全0开始，全部需要写回 */
+        memset(newfs_super.ino_map, 0, NEWFS_BLKS_SZ(newfs_super.ino_map_blks));
+        memset(newfs_super.data_map, 0, NEWFS_BLKS_SZ(newfs_super.data_map_blks));
+        memset(newfs_super.ino_map_dirty, 1, newfs_super.ino_map_blks);
+        memset(newfs_super.data_map_dirty, 1, newfs_super.data_map_blks);
     }
+    newfs_group_pad();
 
-    if (is_init) {                                    /* 分配根节点 */
+    if (is_init) {                                    /* 分配根节点，格式化结果不经日志直接落盘 */
         root_inode = newfs_alloc_inode(root_dentry);
-        newfs_sync_inode(root_inode);
+        if (root_inode == NULL ||
+            newfs_sync_inode(root_inode) != NEWFS_ERROR_NONE ||
+            newfs_sync_meta() != NEWFS_ERROR_NONE ||
+            newfs_cache_flush() != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
     }
     
     root_inode            = newfs_read_inode(root_dentry, NEWFS_ROOT_INO);  /* 读取根目录 */
     root_dentry->inode    = root_inode;
     newfs_super.root_dentry = root_dentry;
     newfs_super.is_mounted  = TRUE;
+    newfs_dcache_init();
     printf("FINISHED READING\n");
 
     // newfs_dump_map();
@@ -427,21 +996,100 @@ int  newfs_mount(struct custom_options options){
  * 
  * @return int 
  */
-int newfs_umount() {
-    struct newfs_super_d  newfs_super_d; 
+/**
+ * @brief 标记位图中[start, start + n)所在的位图块需要写回
+ * 
+ * @param map_dirty newfs_super.ino_map_dirty或newfs_super.data_map_dirty
+ * @param start 起始位下标
+ * @param n 位数
+ */
+void newfs_map_dirty(uint8_t* map_dirty, int start, int n) {
+    int blk;
+    if (n <= 0) {
+        return;
+    }
+    for (blk = start / NEWFS_MAP_BITS_PER_BLK; blk <= (start + n - 1) / NEWFS_MAP_BITS_PER_BLK; blk++) {
+        __atomic_store_n(&map_dirty[blk], TRUE, __ATOMIC_RELEASE);   /* 在位图改动之后可见 */
+    }
+}
 
-    if (!newfs_super.is_mounted) {
-        return NEWFS_ERROR_NONE;
+/**
+ * @brief 写回位图的脏块，每组的位图块在各自的组内，分别写回，组内超出容量的位写为0
+ *
+ * 先取走脏标记再复制位图，复制之后的改动会重新置脏。取走的标记记入事务，事务放弃时重新置脏。
+ *
+ * @param cnt_of 每组有效位数，newfs_group_ino_cnt或newfs_group_data_cnt
+ */
+static int newfs_sync_map(int64_t map_offset, uint8_t* map, uint8_t* map_dirty, int map_blks,
+                          int (*cnt_of)(int)) {
+    uint8_t* blk = (uint8_t*)malloc(NEWFS_BLK_SZ());
+    int grp, cnt, ret = NEWFS_ERROR_NONE;
+    for (grp = 0; grp < map_blks; grp++) {
+        if (!__atomic_exchange_n(&map_dirty[grp], FALSE, __ATOMIC_ACQ_REL)) {
+            continue;
+        }
+        if (newfs_journal_undo_map(map_dirty, grp) != NEWFS_ERROR_NONE) {
+            __atomic_store_n(&map_dirty[grp], TRUE, __ATOMIC_RELAXED);
+            ret = -NEWFS_ERROR_IO;
+            break;
+        }
+        cnt = cnt_of(grp);
+        newfs_bitmap_copy(blk, map + NEWFS_BLKS_SZ(grp), NEWFS_BLK_SZ());
+        memset(blk + NEWFS_ROUND_UP(cnt, UINT8_BITS) / UINT8_BITS, 0,
+               NEWFS_BLK_SZ() - NEWFS_ROUND_UP(cnt, UINT8_BITS) / UINT8_BITS);
+        if (cnt % UINT8_BITS) {
+            blk[cnt / UINT8_BITS] &= (uint8_t)((0x1 << (cnt % UINT8_BITS)) - 1);
+        }
+        if (newfs_meta_write(map_offset + NEWFS_GROUP_OFS(grp), blk, NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+            __atomic_store_n(&map_dirty[grp], TRUE, __ATOMIC_RELAXED);
+            ret = -NEWFS_ERROR_IO;
+            break;
+        }
     }
-    printf("START UNMOUNT!!!\n");
+    free(blk);
+    return ret;
+}
+
+/**
+ * @brief 将有变化的inode、目录项、数据块、超级块与位图写回，元数据作为一个事务提交，
+ * 调用者独占名字空间锁
+ * 
+ * @return int 
+ */
+int newfs_sync_fs() {
+    newfs_journal_begin();
+    /* 从根节点向下刷写有变化的节点 */
+    if (newfs_sync_inode(newfs_super.root_dentry->inode) != NEWFS_ERROR_NONE ||
+        newfs_sync_meta() != NEWFS_ERROR_NONE) {
+        newfs_journal_abort();
+        return -NEWFS_ERROR_IO;
+    }
+    if (newfs_journal_commit() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_journal_release();                          /* 调用者独占名字空间锁，变化已全部提交 */
+    return NEWFS_ERROR_NONE;
+}
 
-    newfs_sync_inode(newfs_super.root_dentry->inode);     /* 从根节点向下刷写节点 */
-                                                    
+/**
+ * @brief 写回超级块与位图中有变化的块
+ * 
+ * @return int 
+ */
+int newfs_sync_meta() {
+    struct newfs_super_d  newfs_super_d; 
+
+    memset(&newfs_super_d, 0, sizeof(struct newfs_super_d));
     newfs_super_d.magic_num          = NEWFS_MAGIC_NUM;
+    newfs_super_d.version            = NEWFS_VERSION;
     newfs_super_d.usage_size = newfs_super.usage_size;
     /*超级块信息写回*/
     newfs_super_d.sb_blks = newfs_super.sb_blks;
     newfs_super_d.sb_offset = newfs_super.sb_offset;
+    /*块组信息写回*/
+    newfs_super_d.group_cnt = newfs_super.group_cnt;
+    newfs_super_d.group_blks = newfs_super.group_blks;
+    newfs_super_d.group_inos = newfs_super.group_inos;
 
     /*索引位图信息写回*/
     newfs_super_d.ino_map_blks = newfs_super.ino_map_blks;
@@ -453,31 +1101,63 @@ int newfs_umount() {
     /*数据位图信息写回*/
     newfs_super_d.data_map_blks = newfs_super.data_map_blks;
     newfs_super_d.data_map_offset = newfs_super.data_map_offset;
+    /*日志区信息写回*/
+    newfs_super_d.journal_blks = newfs_super.journal_blks;
+    newfs_super_d.journal_offset = newfs_super.journal_offset;
     /*数据块信息写回*/
     newfs_super_d.data_blks =  newfs_super.data_blks;
 	newfs_super_d.data_offset = newfs_super.data_offset;
+    newfs_super_d.ino_max = newfs_super.ino_max;
+    newfs_super_d.data_max = newfs_super.data_max;
 
-    /*超级块写回磁盘*/
-    if (newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d, 
-                     sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
-        return -NEWFS_ERROR_IO;
+    /*超级块写回磁盘，只在格式化后内容变化*/
+    if (newfs_super.sb_dirty) {
+        if (newfs_journal_undo_flag(&newfs_super.sb_dirty, TRUE) != NEWFS_ERROR_NONE ||
+            newfs_meta_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d, 
+                         sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        newfs_super.sb_dirty = FALSE;
     }
-    /*索引位图写回磁盘*/
-    if (newfs_driver_write(newfs_super_d.ino_map_offset, (uint8_t *)(newfs_super.ino_map), 
-                         NEWFS_BLKS_SZ(newfs_super_d.ino_map_blks)) != NEWFS_ERROR_NONE) {
+    /*索引位图、数据位图只写回脏块*/
+    if (newfs_sync_map(newfs_super.ino_map_offset, newfs_super.ino_map, newfs_super.ino_map_dirty,
+                       newfs_super.ino_map_blks, newfs_group_ino_cnt) != NEWFS_ERROR_NONE ||
+        newfs_sync_map(newfs_super.data_map_offset, newfs_super.data_map, newfs_super.data_map_dirty,
+                       newfs_super.data_map_blks, newfs_group_data_cnt) != NEWFS_ERROR_NONE) {
         return -NEWFS_ERROR_IO;
     }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 
+ * 
+ * @return int 
+ */
+int newfs_umount() {
+    if (!newfs_super.is_mounted) {
+        return NEWFS_ERROR_NONE;
+    }
+    printf("START UNMOUNT!!!\n");
 
-    /*数据位图写回磁盘*/
-    if (newfs_driver_write(newfs_super_d.data_map_offset, (uint8_t *)(newfs_super.data_map), 
-                         NEWFS_BLKS_SZ(newfs_super_d.data_map_blks)) != NEWFS_ERROR_NONE) {
+    if (newfs_sync_fs() != NEWFS_ERROR_NONE) {
         return -NEWFS_ERROR_IO;
     }
+    /*缓存中的脏块全部写回，清空日志*/
+    if (newfs_journal_checkpoint() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_journal_destroy();
+    newfs_cache_destroy();
+    newfs_dcache_destroy();
 
     free(newfs_super.ino_map);
     free(newfs_super.data_map);
+    free(newfs_super.ino_map_dirty);
+    free(newfs_super.data_map_dirty);
     /*关闭驱动*/
     ddriver_close(NEWFS_DRIVER());
+    newfs_super.dev_map = NULL;
     printf("FINISH UNMOUNT!!!\n");
 
     return NEWFS_ERROR_NONE;
@@ -539,6 +1219,9 @@ char* newfs_get_fname(const char* path) {
  *      3) find a's inode     lvl = 2
  *      4) find b's dentry    如果此时找不到了，is_find=FALSE且返回的是a的inode对应的dentry
  * 
+ * 路径上某一级的inode读入失败（记录校验不通过或读设备出错）时，is_find=FALSE且返回NULL，
+ * 调用者应返回-NEWFS_ERROR_IO。
+ * 
  * @param path 
  * @return struct newfs_dentry* 
  */
@@ -550,46 +1233,52 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
     int   lvl = 0;
     boolean is_hit;
     char* fname = NULL;
-    char* path_cpy = (char*)malloc(sizeof(path));
+    char* path_cpy;
+    char* saveptr;
+    int   gen;
     *is_root = FALSE;
-    strcpy(path_cpy, path);
 
     if (total_lvl == 0) {                           /* 根目录 */
         *is_find = TRUE;
         *is_root = TRUE;
-        dentry_ret = newfs_super.root_dentry;
+        return newfs_super.root_dentry;
+    }
+
+    dentry_ret = newfs_dcache_lookup(path, is_find, &gen); /* 先查路径缓存 */
+    if (dentry_ret != NULL) {
+        if (newfs_load_inode(dentry_ret) == NULL) {
+            *is_find = FALSE;
+            return NULL;
+        }
+        return dentry_ret;
     }
-    printf("root_dentry ino: %d\n",dentry_cursor->inode->ino);
-    printf("root_dentry fist child:%s\n", dentry_cursor->inode->dentrys->fname);
 
-    fname = strtok(path_cpy, "/");       
+    path_cpy = (char*)malloc(strlen(path) + 1);
+    strcpy(path_cpy, path);
+
+    fname = strtok_r(path_cpy, "/", &saveptr);   /* strtok不可重入，多线程下用strtok_r */
     while (fname)
     {   
         lvl++;
-        if (dentry_cursor->inode == NULL) {           /* Cache机制 */
-            newfs_read_inode(dentry_cursor, dentry_cursor->ino);
+        inode = newfs_load_inode(dentry_cursor);      /* Cache机制 */
+        if (inode == NULL) {
+            NEWFS_DBG("[%s] bad inode %d\n", __func__, dentry_cursor->ino);
+            free(path_cpy);
+            *is_find = FALSE;
+            return NULL;
         }
 
-        inode = dentry_cursor->inode;
-
         if (NEWFS_IS_REG(inode) && lvl < total_lvl) { /*如果该文件为普通文件但却不在路径的末尾，则报错*/
             NEWFS_DBG("[%s] not a dir\n", __func__);
+            *is_find = FALSE;
             dentry_ret = inode->dentry;
             break;
         }
         if (NEWFS_IS_DIR(inode)) {
-            dentry_cursor = inode->dentrys;
-            is_hit        = FALSE;
-
-            while (dentry_cursor)   /* 遍历子目录项 */
-            {
-                if (memcmp(dentry_cursor->fname, fname, strlen(fname)) == 0) {
-                    is_hit = TRUE;
-                    break;
-                }
-                printf("%s\n", dentry_cursor->fname);
-                dentry_cursor = dentry_cursor->brother;
-            }
+            newfs_inode_rdlock(inode);
+            dentry_cursor = newfs_dindex_find(inode, fname);   /* 哈希索引查找子目录项 */
+            newfs_inode_unlock(inode);
+            is_hit        = dentry_cursor != NULL;
             
             if (!is_hit) {
                 *is_find = FALSE;
@@ -604,12 +1293,19 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
                 break;
             }
         }
-        fname = strtok(NULL, "/"); 
+        fname = strtok_r(NULL, "/", &saveptr); 
+    }
+    free(path_cpy);
+    if (dentry_ret == NULL) {                       /* 路径以/结尾，最后一级已命中 */
+        *is_find = TRUE;
+        dentry_ret = dentry_cursor;
     }
 
-    if (dentry_ret->inode == NULL) {
-        dentry_ret->inode = newfs_read_inode(dentry_ret, dentry_ret->ino);
+    if (newfs_load_inode(dentry_ret) == NULL) {
+        *is_find = FALSE;
+        return NULL;
     }
+    newfs_dcache_insert(path, dentry_ret, *is_find, gen);
     
     return dentry_ret;
 
@@ -666,6 +1362,9 @@ int newfs_drop_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry)
     if (!is_find) {
         return -NEWFS_ERROR_NOTFOUND;
     }
+    newfs_dindex_remove(inode, dentry);
+    inode->flag |= NEWFS_FLAG_INODE_DIRTY | NEWFS_FLAG_DENTRY_DIRTY;
+    inode->dir_ver++;
     inode->dir_cnt--;
     return inode->dir_cnt;
 }
@@ -676,12 +1375,6 @@ int newfs_drop_inode(struct newfs_inode * inode) {
     struct newfs_dentry*  dentry_to_free;
     struct newfs_inode*   inode_cursor;
 
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int ino_cursor  = 0;
-    int data_cursor = 0;
-    boolean is_find = FALSE;
-
     if (inode == newfs_super.root_dentry->inode) {
         return NEWFS_ERROR_INVAL;
     }
@@ -692,67 +1385,67 @@ int newfs_drop_inode(struct newfs_inode * inode) {
         while (dentry_cursor)
         {   
             inode_cursor = dentry_cursor->inode;
-            newfs_drop_inode(inode_cursor);
+            if (inode_cursor == NULL) {               /* 尚未读入的子inode也要释放其位图 */
+                inode_cursor = newfs_read_inode(dentry_cursor, dentry_cursor->ino);
+            }
+            if (inode_cursor != NULL) {
+                newfs_drop_inode(inode_cursor);
+            }
             newfs_drop_dentry(inode, dentry_cursor);
             dentry_to_free = dentry_cursor;
             dentry_cursor = dentry_cursor->brother;
             free(dentry_to_free);
         }
-
-        for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.ino_map_blks); 
-            byte_cursor++)                            /* 调整inodemap */
-        {
-            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-                if (ino_cursor == inode->ino) {
-                     newfs_super.ino_map[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
-                     is_find = TRUE;
-                     break;
-                }
-                ino_cursor++;
-            }
-            if (is_find == TRUE) {
-                break;
-            }
-        }
+        newfs_dindex_free(inode);
     }
     else if (NEWFS_IS_REG(inode) || NEWFS_IS_SYM_LINK(inode)) {
-        for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.ino_map_blks); 
-            byte_cursor++)                            /* 调整inodemap */
-        {
-            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-                if (ino_cursor == inode->ino) {
-                     newfs_super.ino_map[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
-                     is_find = TRUE;
-                     break;
-                }
-                ino_cursor++;
-            }
-            if (is_find == TRUE) {
-                break;
-            }
-        }
         //删除data
         if (inode->data)
             free(inode->data);
-        //清空data位图
-        int find_data_blks_num = 0;
-        for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.data_map_blks); //字节位
-			byte_cursor++)
-		{
-			for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {          //比特位
-				if(data_cursor == inode->blk_pointers[find_data_blks_num]) {    
-														/* 当前data_cursor位置空闲 */
-					newfs_super.data_map[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
-					find_data_blks_num += 1;           
-					break;
-				}
-				data_cursor++;
-			}
-			if (find_data_blks_num == inode->allocated_nums) {
-				break;
-			}
-		}
-        free(inode);
+        free(inode->data_res);
+        if (inode->data_dirty) {
+            newfs_dirty_add(-newfs_bitmap_count(inode->data_dirty, inode->allocated_nums));
+            free(inode->data_dirty);
+        }
+    }
+    /* 调整inodemap，清空data位图（含间接块） */
+    newfs_bitmap_free(newfs_super.ino_map, inode->ino);
+    newfs_map_dirty(newfs_super.ino_map_dirty, inode->ino, 1);
+    newfs_bmap_truncate(inode, 0);
+    newfs_bmap_free(inode);
+    if (inode->open_cnt > 0) {                        /* 仍有readdir游标，留给newfs_put_dir释放 */
+        inode->flag |= NEWFS_FLAG_INODE_DEAD;
+        inode->dir_ver++;
+        return NEWFS_ERROR_NONE;
     }
+    pthread_rwlock_destroy(&inode->lock);
+    pthread_mutex_destroy(&inode->fault_lock);
+    free(inode);
     return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 为readdir游标固定目录inode，游标关闭前drop_inode不会释放它
+ *
+ * @param inode 目录的inode
+ */
+void newfs_get_dir(struct newfs_inode* inode) {
+    __atomic_fetch_add(&inode->open_cnt, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 游标关闭时调用，最后一个游标负责释放已被删除的目录inode
+ *
+ * drop_inode只在独占名字空间锁下运行，这里在共享锁下，二者不会并发，
+ * 因此递减到0时看到的DEAD标记是确定的。
+ *
+ * @param inode 目录的inode
+ */
+void newfs_put_dir(struct newfs_inode* inode) {
+    if (__atomic_sub_fetch(&inode->open_cnt, 1, __ATOMIC_ACQ_REL) == 0 &&
+        (inode->flag & NEWFS_FLAG_INODE_DEAD)) {
+        pthread_rwlock_destroy(&inode->lock);
+        pthread_mutex_destroy(&inode->fault_lock);
+        free(inode);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,160 @@
+/******************************************************************************
+* SECTION: 位图分配器多线程基准
+* 每个线程反复分配、释放位图中的位（单个位与连续区交替），持有的位放在一个环里，
+* 环满时释放最早分配的。另用一个每位一项的属主数组检查分配结果：分配得到的位
+* 必须没有属主，否则说明同一位被交给了两个线程。依次以1、2、4...个线程运行，
+* 输出每种线程数下的吞吐（分配与释放都计为一次操作）。
+*
+* 用法: bitmap_bench [最大线程数] [位图位数] [每线程操作数]
+*******************************************************************************/
+#include "../../include/newfs.h"
+#include <time.h>
+
+#define BENCH_HOLD                256     /* 每个线程最多同时持有的分配 */
+#define BENCH_RUN_EVERY           8       /* 每隔几次分配改为分配一段连续位 */
+#define BENCH_RUN_LEN             4
+
+struct bench_hold {
+    int start;
+    int len;
+};
+
+struct bench_thread {
+    pthread_t         tid;
+    int               id;
+    long              ops;
+    long              full;               /* 位图已满而分配失败的次数 */
+    struct bench_hold ring[BENCH_HOLD];
+};
+
+static uint8_t*           bench_map;
+static int*               bench_owner;
+static int                bench_nbits;
+static long               bench_iters;
+static volatile boolean   bench_failed = FALSE;
+
+static void bench_claim(struct bench_thread* t, int start, int len) {
+    int i, expect;
+    for (i = start; i < start + len; i++) {
+        expect = 0;
+        if (!__atomic_compare_exchange_n(bench_owner + i, &expect, t->id, FALSE,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            fprintf(stderr, "double handout: bit %d given to thread %d, owned by thread %d\n",
+                    i, t->id, expect);
+            bench_failed = TRUE;
+        }
+    }
+}
+
+static void bench_release(struct bench_thread* t, struct bench_hold* h) {
+    int i;
+    for (i = h->start; i < h->start + h->len; i++) {
+        if (__atomic_exchange_n(bench_owner + i, 0, __ATOMIC_ACQ_REL) != t->id) {
+            fprintf(stderr, "bit %d freed by thread %d but not owned by it\n", i, t->id);
+            bench_failed = TRUE;
+        }
+        newfs_bitmap_free(bench_map, i);
+    }
+    t->ops += h->len;
+    h->len = 0;
+}
+
+static void* bench_worker(void* arg) {
+    struct bench_thread* t = (struct bench_thread*)arg;
+    int* hint = newfs_bitmap_hint(NEWFS_HINT_DATA, 0, bench_nbits);
+    int  head = 0, len, start;
+    long n;
+
+    for (n = 0; n < bench_iters && !bench_failed; n++) {
+        struct bench_hold* h = &t->ring[head];
+        if (h->len > 0) {
+            bench_release(t, h);
+        }
+        len   = n % BENCH_RUN_EVERY == 0 ? BENCH_RUN_LEN : 1;
+        start = len == 1 ? newfs_bitmap_alloc(bench_map, bench_nbits, hint)
+                         : newfs_bitmap_alloc_run(bench_map, bench_nbits, hint, len);
+        if (start < 0) {
+            t->full++;
+            continue;
+        }
+        bench_claim(t, start, len);
+        h->start = start;
+        h->len   = len;
+        t->ops  += len;
+        head = (head + 1) % BENCH_HOLD;
+    }
+    for (head = 0; head < BENCH_HOLD; head++) {
+        if (t->ring[head].len > 0) {
+            bench_release(t, &t->ring[head]);
+        }
+    }
+    return NULL;
+}
+
+static double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief 以nthreads个线程运行一轮
+ *
+ * @return int 0表示分配结果正确
+ */
+static int bench_round(int nthreads) {
+    struct bench_thread* threads = calloc(nthreads, sizeof(struct bench_thread));
+    long   ops = 0, full = 0;
+    double begin, secs;
+    int    i, used;
+
+    begin = bench_now();
+    for (i = 0; i < nthreads; i++) {
+        threads[i].id = i + 1;
+        pthread_create(&threads[i].tid, NULL, bench_worker, &threads[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i].tid, NULL);
+        ops  += threads[i].ops;
+        full += threads[i].full;
+    }
+    secs = bench_now() - begin;
+    free(threads);
+
+    used = newfs_bitmap_count(bench_map, bench_nbits);
+    if (used != 0) {
+        fprintf(stderr, "%d bits still allocated after all threads freed theirs\n", used);
+        bench_failed = TRUE;
+    }
+    printf("threads %2d: %10.0f ops/s  %8.0f ops/s per thread  (%ld ops, %ld full, %.3fs)\n",
+           nthreads, ops / secs, ops / secs / nthreads, ops, full, secs);
+    return bench_failed ? -1 : 0;
+}
+
+int main(int argc, char** argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    int nthreads;
+
+    bench_nbits = argc > 2 ? atoi(argv[2]) : 1 << 16;
+    bench_iters = argc > 3 ? atol(argv[3]) : 1000000;
+    if (max_threads <= 0 || bench_nbits <= 0 || bench_iters <= 0) {
+        fprintf(stderr, "usage: %s [max_threads] [nbits] [ops_per_thread]\n", argv[0]);
+        return 1;
+    }
+    /* 位图按64位字访问，按字对齐并补齐 */
+    bench_map   = aligned_alloc(sizeof(uint64_t), NEWFS_ROUND_UP(bench_nbits, 64) / 8);
+    bench_owner = calloc(bench_nbits, sizeof(int));
+    memset(bench_map, 0, NEWFS_ROUND_UP(bench_nbits, 64) / 8);
+
+    printf("bitmap bench: %d bits, %ld allocations per thread\n", bench_nbits, bench_iters);
+    for (nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+        if (bench_round(nthreads) != 0) {
+            printf("FAIL: bitmap handed out a bit twice or lost a free\n");
+            return 1;
+        }
+    }
+    printf("PASS: no bit handed out twice\n");
+    free(bench_map);
+    free(bench_owner);
+    return 0;
+}
@@ -0,0 +1,20 @@
+#!/bin/bash
+# 编译并运行位图分配器的多线程基准，参数原样传给bitmap_bench:
+#   ./bitmap_bench.sh [最大线程数] [位图位数] [每线程操作数]
+# SANITIZE=thread ./bitmap_bench.sh 以ThreadSanitizer编译运行
+WORK_DIR=$(cd `dirname $0`; pwd)
+cd $WORK_DIR || exit
+
+CFLAGS="-O2 -g -D_FILE_OFFSET_BITS=64 -I../../include $(pkg-config --cflags fuse 2>/dev/null)"
+if [ -n "$SANITIZE" ]; then
+    CFLAGS="$CFLAGS -fsanitize=$SANITIZE"
+fi
+
+gcc $CFLAGS -o bitmap_bench bitmap_bench.c ../../src/newfs_bitmap.c -lpthread || {
+    echo "Bench Fail : 编译失败"
+    exit 1
+}
+./bitmap_bench "$@"
+RET=$?
+rm -f bitmap_bench
+exit $RET
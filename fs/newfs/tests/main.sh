@@ -3,8 +3,8 @@ POINTS=0
 TOTAL_POINTS=0
 TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh)
 # mount.sh mkdir.sh touch.sh ls.sh remount.sh (read.sh write.sh cp.sh)
-ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
-ALL_TEST_SCORES=(1 4 5 4 16 2 2)
+ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigdisk.sh replay.sh concurrent.sh engines.sh names.sh)
+ALL_TEST_SCORES=(1 4 5 4 16 2 2 3 5 4 3 3)
 MNTPOINT='./mnt'
 PROJECT_NAME="newfs"
 
@@ -35,6 +35,26 @@ elif [[ "${LEVEL}" == "6" ]]; then
     echo "开始mount, mkdir, touch, ls, read&write, cp, umount测试"
     TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
     sleep 1
+elif [[ "${LEVEL}" == "7" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, 大容量设备测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigdisk.sh)
+    sleep 1
+elif [[ "${LEVEL}" == "8" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, 大容量设备, 崩溃重放测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigdisk.sh replay.sh)
+    sleep 1
+elif [[ "${LEVEL}" == "9" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, 大容量设备, 崩溃重放, 并发创建测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigdisk.sh replay.sh concurrent.sh)
+    sleep 1
+elif [[ "${LEVEL}" == "10" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, 大容量设备, 崩溃重放, 并发创建, 设备读写方式测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigdisk.sh replay.sh concurrent.sh engines.sh)
+    sleep 1
+elif [[ "${LEVEL}" == "11" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, 大容量设备, 崩溃重放, 并发创建, 设备读写方式, 文件名测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigdisk.sh replay.sh concurrent.sh engines.sh names.sh)
+    sleep 1
 else
     echo "未知测试参数"
     exit 1
@@ -95,8 +115,9 @@ function fail() {
 }
 
 # Utils
+# 额外的参数作为挂载选项传给文件系统，如mount_fuse --uring
 function mount_fuse() {
-    "$ROOT_PATH"/../build/"${PROJECT_NAME}" --device="$HOME"/ddriver "${MNTPOINT}"
+    "$ROOT_PATH"/../build/"${PROJECT_NAME}" --device="$HOME"/ddriver "$@" "${MNTPOINT}"
 }
 
 function check_mount() {
@@ -225,7 +246,11 @@ function handle_timeout() {
 # Main
 echo "测试脚本工程根目录: $ROOT_PATH"
 
+# 基础的7个阶段共100秒，之后的阶段都要重新挂载若干次，每个另加40秒
 max_execution_time=100
+if (( ${#TEST_CASES[@]} > 7 )); then
+    max_execution_time=$((max_execution_time + 40 * (${#TEST_CASES[@]} - 7)))
+fi
 (
     sleep $max_execution_time
     handle_timeout
@@ -0,0 +1,73 @@
+#!/bin/bash
+
+TEST_CASE="case 8 - big disk"
+
+# 3GB的设备，块组与数据块偏移都超过int能表示的2GB
+BIG_DISK_SZ=$((3 * 1024 * 1024 * 1024))
+BIG_DIRS=300
+
+function mount_big () {
+    DDRIVER_DISK_SZ=$BIG_DISK_SZ DDRIVER_PROFILE=nodelay mount_fuse
+}
+
+function check_big_format () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 根目录的st_blocks为设备的块数，st_blksize为块大小
+    DISK_BYTES=$(stat -c '%b * %o' "$_PARAM")
+    DISK_BYTES=$((DISK_BYTES))
+    if (( DISK_BYTES != BIG_DISK_SZ )); then
+        fail "$_TEST_CASE: 设备大小应为${BIG_DISK_SZ}, 实际为${DISK_BYTES}"
+        return 1
+    fi
+    return 0
+}
+
+# 每个目录放在空闲数据块最多的组，目录下的文件数据随之落在该组，300个目录会用到2GB之后的组
+function create_big_spread () {
+    for ((i = 0; i < BIG_DIRS; i++)); do
+        mkdir "${MNTPOINT}/big$i" || return 1
+        echo "big file $i" > "${MNTPOINT}/big$i/file" || return 1
+    done
+    return 0
+}
+
+function check_big_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    for ((i = 0; i < BIG_DIRS; i++)); do
+        if [[ "$(cat "${_PARAM}/big$i/file" 2>/dev/null)" != "big file $i" ]]; then
+            fail "$_TEST_CASE: remount后${_PARAM}/big$i/file的内容不正确"
+            return 1
+        fi
+    done
+    return 0
+}
+
+clean_mount
+rm -f "$HOME"/ddriver
+
+if ! mount_big || ! check_mount; then
+    fail "$TEST_CASE: 无法在${BIG_DISK_SZ}字节的设备上挂载"
+    exit 1
+fi
+
+TEST_CASE="case 8.1 - format a ${BIG_DISK_SZ} bytes device"
+core_tester ls "${MNTPOINT}" check_big_format "$TEST_CASE" 1
+
+if ! create_big_spread; then
+    fail "$TEST_CASE: 在大设备上创建文件失败"
+fi
+
+clean_mount
+sleep 1
+mount_big
+
+TEST_CASE="case 8.2 - remount the big device"
+core_tester ls "${MNTPOINT}" check_big_remount "$TEST_CASE" 2
+
+clean_mount
+# 换回默认大小的设备，不影响之后的测试
+rm -f "$HOME"/ddriver
+mount_fuse
+clean_mount
@@ -0,0 +1,79 @@
+#!/bin/bash
+
+TEST_CASE="case 10 - concurrent create"
+
+CONC_WORKERS=8
+CONC_FILES=32
+
+# 每个worker在共享目录与自己的目录下各创建CONC_FILES个文件，共享目录的并发插入
+# 会落在同一个目录项块上
+function conc_worker () {
+    _ID=$1
+    mkdir "${MNTPOINT}/conc/w${_ID}" || return 1
+    for ((j = 0; j < CONC_FILES; j++)); do
+        echo "w${_ID} f$j" > "${MNTPOINT}/conc/shared/w${_ID}_f$j" || return 1
+        touch "${MNTPOINT}/conc/w${_ID}/f$j" || return 1
+    done
+    return 0
+}
+
+function create_concurrently () {
+    mkdir_and_check "${MNTPOINT}/conc"
+    mkdir_and_check "${MNTPOINT}/conc/shared"
+    PIDS=()
+    for ((i = 0; i < CONC_WORKERS; i++)); do
+        conc_worker "$i" &
+        PIDS+=($!)
+    done
+    RET=0
+    for PID in "${PIDS[@]}"; do
+        wait "$PID" || RET=1
+    done
+    return $RET
+}
+
+function check_concurrent () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    CNT=$(ls "${_PARAM}/shared" 2>/dev/null | wc -l)
+    if (( CNT != CONC_WORKERS * CONC_FILES )); then
+        fail "$_TEST_CASE: ${_PARAM}/shared下应有$((CONC_WORKERS * CONC_FILES))个文件, 实际为${CNT}"
+        return 1
+    fi
+    for ((i = 0; i < CONC_WORKERS; i++)); do
+        CNT=$(ls "${_PARAM}/w$i" 2>/dev/null | wc -l)
+        if (( CNT != CONC_FILES )); then
+            fail "$_TEST_CASE: ${_PARAM}/w$i下应有${CONC_FILES}个文件, 实际为${CNT}"
+            return 1
+        fi
+        for ((j = 0; j < CONC_FILES; j++)); do
+            if [[ "$(cat "${_PARAM}/shared/w${i}_f$j" 2>/dev/null)" != "w$i f$j" ]]; then
+                fail "$_TEST_CASE: ${_PARAM}/shared/w${i}_f$j的内容不正确"
+                return 1
+            fi
+        done
+    done
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+if ! create_concurrently; then
+    fail "$TEST_CASE: 并发创建文件失败"
+fi
+
+TEST_CASE="case 10.1 - create files from ${CONC_WORKERS} processes at once"
+core_tester ls "${MNTPOINT}/conc" check_concurrent "$TEST_CASE" 2
+
+clean_mount
+sleep 1
+mount_fuse
+
+TEST_CASE="case 10.2 - remount after concurrent create"
+core_tester ls "${MNTPOINT}/conc" check_concurrent "$TEST_CASE" 2
+
+clean_mount
+clean_ddriver
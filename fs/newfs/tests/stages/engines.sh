@@ -0,0 +1,74 @@
+#!/bin/bash
+
+TEST_CASE="case 11 - device engines"
+
+ENGINES=(--mmap --uring --direct)
+ENGINE_SRC=$(mktemp)
+# 跨越多个块且不按块对齐，读写会经过批量与合并的路径
+head -c $((200 * 1024 + 123)) /dev/urandom > "$ENGINE_SRC"
+
+function write_with_engine () {
+    _OPT=$1
+    mount_fuse "$_OPT"
+    if ! check_mount; then
+        return 1
+    fi
+    mkdir_and_check "${MNTPOINT}/eng"
+    cp "$ENGINE_SRC" "${MNTPOINT}/eng/data" || return 1
+    for ((i = 0; i < 16; i++)); do
+        echo "engine $_OPT $i" > "${MNTPOINT}/eng/small$i" || return 1
+    done
+    sync "${MNTPOINT}/eng/data" || return 1
+    clean_mount
+    return 0
+}
+
+function check_engine_files () {
+    _PARAM=$1
+    _OPT=$2
+    cmp -s "$ENGINE_SRC" "${_PARAM}/data" || return 1
+    for ((i = 0; i < 16; i++)); do
+        if [[ "$(cat "${_PARAM}/small$i" 2>/dev/null)" != "engine $_OPT $i" ]]; then
+            return 1
+        fi
+    done
+    return 0
+}
+
+function check_engine () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 用默认方式挂载读出以该方式写入的内容，再以该方式挂载读出
+    sleep 1
+    mount_fuse
+    if ! check_engine_files "$_PARAM" "$ENGINE_OPT"; then
+        fail "$_TEST_CASE: 以${ENGINE_OPT}写入的文件在默认方式挂载后内容不正确"
+        return 1
+    fi
+    clean_mount
+    sleep 1
+    mount_fuse "$ENGINE_OPT"
+    if ! check_engine_files "$_PARAM" "$ENGINE_OPT"; then
+        fail "$_TEST_CASE: 以${ENGINE_OPT}挂载后读出的文件内容不正确"
+        return 1
+    fi
+    clean_mount
+    return 0
+}
+
+for ENGINE_OPT in "${ENGINES[@]}"; do
+    clean_mount
+    clean_ddriver
+    TEST_CASE="case 11 - mount with ${ENGINE_OPT}"
+    if ! write_with_engine "$ENGINE_OPT"; then
+        fail "$TEST_CASE: 以${ENGINE_OPT}挂载并写入文件失败"
+        clean_mount
+        continue
+    fi
+    TEST_CASE="case 11 - write and read back with ${ENGINE_OPT}"
+    core_tester true "${MNTPOINT}/eng" check_engine "$TEST_CASE" 1
+done
+
+rm -f "$ENGINE_SRC"
+clean_mount
+clean_ddriver
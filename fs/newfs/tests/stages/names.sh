@@ -0,0 +1,95 @@
+#!/bin/bash
+
+TEST_CASE="case 12 - dentry names"
+
+NAME_MAX_LEN=127                          # 名字最长127字节
+
+# 长度为$1的名字：以长度开头，其余用x补齐，各长度的名字互不相同
+function name_of () {
+    _LEN=$1
+    printf '%s%s' "$_LEN" "$(head -c $((_LEN - ${#_LEN})) /dev/zero | tr '\0' x)"
+}
+
+# 每种长度一个文件，目录项记录按名字长度变长存放，会跨越多个块；之后删除一部分，
+# 空出的记录位置由长度不同的新名字与rename复用
+function create_names () {
+    mkdir_and_check "${MNTPOINT}/names"
+    for ((len = 1; len <= NAME_MAX_LEN; len++)); do
+        echo "$len" > "${MNTPOINT}/names/$(name_of $len)" || return 1
+    done
+    for ((len = 3; len <= NAME_MAX_LEN; len += 3)); do
+        rm "${MNTPOINT}/names/$(name_of $len)" || return 1
+    done
+    for ((len = 5; len <= NAME_MAX_LEN; len += 15)); do
+        mv "${MNTPOINT}/names/$(name_of $len)" "${MNTPOINT}/names/r$(name_of $((len - 1)))" || return 1
+    done
+    return 0
+}
+
+function expected_names () {
+    for ((len = 1; len <= NAME_MAX_LEN; len++)); do
+        if (( len % 3 == 0 )); then
+            continue
+        elif (( len % 15 == 5 )); then
+            echo "r$(name_of $((len - 1)))"
+        else
+            name_of $len
+            echo
+        fi
+    done
+}
+
+function check_names () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if [[ "$(ls -A "$_PARAM" | sort)" != "$(expected_names | sort)" ]]; then
+        fail "$_TEST_CASE: ${_PARAM}下的文件名与预期不符"
+        return 1
+    fi
+    for ((len = 1; len <= NAME_MAX_LEN; len++)); do
+        if (( len % 3 != 0 && len % 15 != 5 )) &&
+           [[ "$(cat "${_PARAM}/$(name_of $len)")" != "$len" ]]; then
+            fail "$_TEST_CASE: ${_PARAM}/$(name_of $len)的内容不正确"
+            return 1
+        fi
+    done
+    return 0
+}
+
+function check_name_too_long () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    for len in 128 200; do
+        if touch "${_PARAM}/$(name_of $len)" 2>/dev/null ||
+           mkdir "${_PARAM}/$(name_of $len)" 2>/dev/null; then
+            fail "$_TEST_CASE: 长度为${len}的名字应当被拒绝"
+            return 1
+        fi
+    done
+    check_names "$_PARAM" "$_TEST_CASE"
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+if ! create_names; then
+    fail "$TEST_CASE: 创建、删除或重命名文件失败"
+fi
+
+TEST_CASE="case 12.1 - names of every length up to ${NAME_MAX_LEN} bytes"
+core_tester ls "${MNTPOINT}/names" check_names "$TEST_CASE" 1
+
+TEST_CASE="case 12.2 - reject names longer than ${NAME_MAX_LEN} bytes"
+core_tester ls "${MNTPOINT}/names" check_name_too_long "$TEST_CASE" 1
+
+clean_mount
+sleep 1
+mount_fuse
+
+TEST_CASE="case 12.3 - remount packed names"
+core_tester ls "${MNTPOINT}/names" check_names "$TEST_CASE" 1
+
+clean_mount
+clean_ddriver
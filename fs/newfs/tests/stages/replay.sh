@@ -0,0 +1,82 @@
+#!/bin/bash
+
+TEST_CASE="case 9 - journal replay"
+
+REPLAY_FILES=8
+
+function kill_fuse () {
+    # 模拟崩溃：不经umount直接杀掉文件系统进程，日志不做检查点
+    FS_PIDS=$(pgrep -u "$USER" -x "$PROJECT_NAME")
+    for PID in $FS_PIDS; do
+        kill -9 "$PID"
+    done
+    sleep 1
+    fusermount -u "${MNTPOINT}" 2>/dev/null || umount -l "${MNTPOINT}" 2>/dev/null
+}
+
+function create_and_fsync () {
+    mkdir_and_check "${MNTPOINT}/jdir"
+    for ((i = 0; i < REPLAY_FILES; i++)); do
+        echo "journal $i" > "${MNTPOINT}/jdir/file$i" || return 1
+    done
+    mv "${MNTPOINT}/jdir/file0" "${MNTPOINT}/jdir/moved" || return 1
+    # fsync各文件与目录，元数据经日志提交
+    sync "${MNTPOINT}"/jdir/* "${MNTPOINT}/jdir" "${MNTPOINT}" || return 1
+    return 0
+}
+
+function check_replay () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if [[ "$(cat "${_PARAM}/moved" 2>/dev/null)" != "journal 0" ]] || [ -e "${_PARAM}/file0" ]; then
+        fail "$_TEST_CASE: 崩溃前fsync过的rename在重新挂载后没有生效"
+        return 1
+    fi
+    for ((i = 1; i < REPLAY_FILES; i++)); do
+        if [[ "$(cat "${_PARAM}/file$i" 2>/dev/null)" != "journal $i" ]]; then
+            fail "$_TEST_CASE: 崩溃前fsync过的${_PARAM}/file$i在重新挂载后丢失或内容不正确"
+            return 1
+        fi
+    done
+    return 0
+}
+
+function check_after_replay () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 重放之后文件系统可以继续修改，并正常umount、remount
+    touch "${_PARAM}/after" && rm "${_PARAM}/moved" || {
+        fail "$_TEST_CASE: 重放之后无法继续修改文件系统"
+        return 1
+    }
+    clean_mount
+    sleep 1
+    mount_fuse
+    if [ ! -e "${_PARAM}/after" ] || [ -e "${_PARAM}/moved" ]; then
+        fail "$_TEST_CASE: 重放之后的修改在remount后不正确"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+if ! create_and_fsync; then
+    fail "$TEST_CASE: 创建并fsync文件失败"
+fi
+
+kill_fuse
+
+try_mount_or_fail
+
+TEST_CASE="case 9.1 - replay fsynced metadata after a crash"
+core_tester ls "${MNTPOINT}/jdir" check_replay "$TEST_CASE" 3
+
+TEST_CASE="case 9.2 - modify and remount after replay"
+core_tester ls "${MNTPOINT}/jdir" check_after_replay "$TEST_CASE" 2
+
+clean_mount
+clean_ddriver
@@ -39,10 +39,15 @@ else
     echo "----测试阶段4：增加 umount 及 remount 测试"
     echo "----测试阶段5：增加 read 及 write 测试"
     echo "----测试阶段6：增加 copy 测试"
-    read -r -p "按照你的进度输入测试等级[数字1-6]: " LEVEL 
-    if [[ "${LEVEL}" -ge "1" ]] && [[ "${LEVEL}" -le "6" ]]; then
+    echo "----测试阶段7：增加 大于2GB设备的格式化及 remount 测试"
+    echo "----测试阶段8：增加 崩溃后日志重放测试"
+    echo "----测试阶段9：增加 多进程并发创建测试"
+    echo "----测试阶段10：增加 mmap、io_uring、O_DIRECT读写方式测试"
+    echo "----测试阶段11：增加 各种长度文件名的存放与 remount 测试"
+    read -r -p "按照你的进度输入测试等级[数字1-11]: " LEVEL 
+    if [[ "${LEVEL}" -ge "1" ]] && [[ "${LEVEL}" -le "11" ]]; then
         ./main.sh "${LEVEL}"
     else
-        echo "!! Wrong Test Level! Please input 1 to 6 !!"
+        echo "!! Wrong Test Level! Please input 1 to 11 !!"
     fi
 fi
\ No newline at end of file
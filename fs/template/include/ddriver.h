@@ -10,7 +10,7 @@
  * @param path ddriver设备路径
  * @return int 0成功，否则失败
  */
-int ddriver_open(char *path);
+int ddriver_open(const char *path);
 
 /**
  * @brief 移动ddriver磁盘头
@@ -18,9 +18,9 @@ int ddriver_open(char *path);
  * @param fd ddriver设备handler
  * @param offset 移动到的位置，注意要和设备IO单位对齐
  * @param whence SEEK_SET即可
- * @return int 0成功，否则失败
+ * @return off_t 新的位置，失败返回负数
  */
-int ddriver_seek(int fd, off_t offset, int whence);
+off_t ddriver_seek(int fd, off_t offset, int whence);
 
 /**
  * @brief 写入数据